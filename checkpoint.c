@@ -0,0 +1,670 @@
+/*
+ * Save the merged forest to a checkpoint file and load it back.
+ *
+ * Everything export_commits(), export_authors() and dump_rev_graph()
+ * need after merge_to_changesets() is written out: the rev_master
+ * table, every CVS revision, the revdir packs, the gitspace commits
+ * and branch heads, the tags, and the generators in the packed form
+ * of genpack.c.  Pointers become table indices.  Strings and revision
+ * numbers go to two tables at the end of the file, located through
+ * the header, so the writer can intern them as it goes; the loader
+ * maps the file and re-atomizes them before reading the body.
+ *
+ * The format is native-endian and carries the sizes of the types it
+ * depends on, so a checkpoint is only loadable by a build of the same
+ * shape.  Generators still refer to the delta text in the masters, so
+ * a checkpoint must be loaded from the directory it was written in and
+ * with the masters unchanged.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cvs.h"
+#include "revdir.h"
+
+#define CHECKPOINT_MAGIC	"cfeckpt\n"
+#define CHECKPOINT_VERSION	1
+
+typedef struct _checkpoint_header {
+    char	magic[8];
+    uint32_t	version;
+    uint16_t	layout[6];	/* type sizes the writer was built with */
+    uint64_t	strings;	/* file offset of the string table */
+    uint64_t	numbers;	/* file offset of the revision-number table */
+} checkpoint_header;
+
+typedef struct _ptr_index {
+    /* open-addressed map from pointers to 1-origin table positions */
+    const void	**keys;
+    serial_t	*values;
+    const void	**order;	/* pointers in the order first seen */
+    size_t	mask;
+    serial_t	count;
+} ptr_index;
+
+#define PUT(v)	checkpoint_put(&(v), sizeof(v))
+#define GET(v)	checkpoint_get(&(v), sizeof(v))
+
+#define COMMIT_TAIL	0x01
+#define COMMIT_TAILED	0x02
+#define COMMIT_DEAD	0x04
+#define COMMIT_EMITTED	0x08
+
+#define REF_SHOWN	0x01
+#define REF_TAIL	0x02
+
+#define NODE_VERSION	0x01
+#define NODE_PATCH	0x02
+#define NODE_STARTS	0x04
+
+static FILE		*checkpoint_fp;
+static const char	*checkpoint_in, *checkpoint_end;
+
+/* writer state */
+static ptr_index	string_index, number_index, git_index, ref_index;
+static const rev_master	*saved_masters;
+static serial_t		*commit_base;	/* global index of each master's first revision */
+
+/* loader state */
+static const char	**string_at;
+static const cvs_number	**number_at;
+static cvs_commit	**commit_at;
+static serial_t		nstrings, nnumbers, ncommits;
+
+static void
+checkpoint_layout(uint16_t *layout)
+/* describe the build, so a mismatched checkpoint is refused */
+{
+    layout[0] = sizeof(serial_t);
+    layout[1] = sizeof(cvstime_t);
+    layout[2] = sizeof(off_t);
+    layout[3] = sizeof(size_t);
+    layout[4] = sizeof(cvs_number);
+#ifdef TREEPACK
+    layout[5] = 1;
+#else
+    layout[5] = 0;
+#endif /* TREEPACK */
+}
+
+void
+checkpoint_put(const void *buf, const size_t len)
+/* append raw bytes to the checkpoint being written */
+{
+    if (fwrite(buf, 1, len, checkpoint_fp) != len)
+	fatal_system_error("checkpoint write failed");
+}
+
+void
+checkpoint_get(void *buf, const size_t len)
+/* consume raw bytes from the checkpoint being read */
+{
+    if ((size_t)(checkpoint_end - checkpoint_in) < len)
+	fatal_error("checkpoint file is truncated");
+    memcpy(buf, checkpoint_in, len);
+    checkpoint_in += len;
+}
+
+static size_t
+ptr_hash(const void *p)
+{
+    return (size_t)(((uint64_t)(uintptr_t)p * 0x9E3779B97F4A7C15ULL) >> 24);
+}
+
+static void
+ptr_index_init(ptr_index *ix, const size_t size)
+/* size must be a power of two */
+{
+    ix->keys = xcalloc(size, sizeof(void *), "checkpoint index");
+    ix->values = xmalloc(size * sizeof(serial_t), "checkpoint index");
+    ix->order = xmalloc((size / 2) * sizeof(void *), "checkpoint index");
+    ix->mask = size - 1;
+    ix->count = 0;
+}
+
+static void
+ptr_index_free(ptr_index *ix)
+{
+    free(ix->keys);
+    free(ix->values);
+    free(ix->order);
+}
+
+static serial_t
+ptr_index_find(const ptr_index *ix, const void *p)
+/* 1-origin table position of p, 0 for NULL or not yet entered */
+{
+    size_t slot;
+
+    if (p == NULL)
+	return 0;
+    for (slot = ptr_hash(p) & ix->mask; ix->keys[slot]; slot = (slot + 1) & ix->mask)
+	if (ix->keys[slot] == p)
+	    return ix->values[slot];
+    return 0;
+}
+
+static serial_t
+ptr_index_ref(ptr_index *ix, const void *p)
+/* 1-origin table position of p, entering it if new; 0 for NULL */
+{
+    size_t slot;
+
+    if (p == NULL)
+	return 0;
+    if ((ix->count + 1) * 2 > ix->mask + 1) {
+	ptr_index old = *ix;
+	serial_t i;
+
+	ptr_index_init(ix, (old.mask + 1) * 2);
+	for (i = 0; i < old.count; i++)
+	    (void)ptr_index_ref(ix, old.order[i]);
+	ptr_index_free(&old);
+    }
+    for (slot = ptr_hash(p) & ix->mask; ix->keys[slot]; slot = (slot + 1) & ix->mask)
+	if (ix->keys[slot] == p)
+	    return ix->values[slot];
+    ix->keys[slot] = p;
+    ix->order[ix->count] = p;
+    return ix->values[slot] = ++ix->count;
+}
+
+static void
+put_string(const char *s)
+{
+    serial_t ref = ptr_index_ref(&string_index, s);
+    PUT(ref);
+}
+
+static void
+put_number(const cvs_number *n)
+{
+    serial_t ref = ptr_index_ref(&number_index, n);
+    PUT(ref);
+}
+
+static serial_t
+file_index(const cvs_commit *c)
+/* global index of a CVS revision across all master slabs */
+{
+    return commit_base[c->master - saved_masters] + (serial_t)(c - c->master->commits);
+}
+
+static void
+put_commit(const cvs_commit *c, const serial_t parent)
+/* write the members cvs_commit and git_commit have in common */
+{
+    unsigned char flags = 0;
+
+    PUT(parent);
+    put_string(c->log);
+    put_string(c->author);
+    put_string(c->commitid);
+    PUT(c->date);
+    PUT(c->serial);
+    PUT(c->refcount);
+    if (c->tail)
+	flags |= COMMIT_TAIL;
+    if (c->tailed)
+	flags |= COMMIT_TAILED;
+    if (c->dead)
+	flags |= COMMIT_DEAD;
+    PUT(flags);
+}
+
+static void
+gather_git_commits(git_commit *g)
+/* number a gitspace commit and its not yet numbered ancestors */
+{
+    for (; g && !ptr_index_find(&git_index, g); g = g->parent)
+	(void)ptr_index_ref(&git_index, g);
+}
+
+void
+checkpoint_save(const char *path, forest_t *forest)
+/* write the merged forest to a checkpoint file */
+{
+    checkpoint_header header;
+    serial_t i, j, n, ref, total = 0;
+    unsigned char nogit;
+    rev_ref *h;
+    tag_t *t;
+
+    if ((checkpoint_fp = fopen(path, "w")) == NULL)
+	fatal_system_error("%s", path);
+    memset(&header, '\0', sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    checkpoint_layout(header.layout);
+    PUT(header);	/* rewritten once the table offsets are known */
+
+    ptr_index_init(&string_index, 1024);
+    ptr_index_init(&number_index, 1024);
+    ptr_index_init(&git_index, 1024);
+    ptr_index_init(&ref_index, 64);
+
+    PUT(forest->filecount);
+    PUT(forest->textsize);
+    PUT(forest->errcount);
+    PUT(forest->skew_vulnerable);
+    PUT(forest->total_revisions);
+
+    saved_masters = forest->masters;
+    commit_base = xmalloc(forest->filecount * sizeof(serial_t), __func__);
+    for (i = 0; i < forest->filecount; i++) {
+	const rev_master *m = &forest->masters[i];
+	uint32_t mode = m->mode;
+
+	commit_base[i] = total;
+	total += m->ncommits;
+	put_string(m->name);
+	put_string(m->fileop_name);
+	put_string(m->dir ? m->dir->name : NULL);
+	PUT(mode);
+	PUT(m->ncommits);
+    }
+    for (i = 0; i < forest->filecount; i++) {
+	const rev_master *m = &forest->masters[i];
+
+	for (j = 0; j < m->ncommits; j++) {
+	    const cvs_commit *c = &m->commits[j];
+	    unsigned char emitted = c->emitted ? COMMIT_EMITTED : 0;
+
+	    put_commit(c, c->parent ? file_index(c->parent) + 1 : 0);
+	    PUT(emitted);
+	    PUT(c->hash);
+	    put_number(c->number);
+	}
+    }
+    revdir_save_packs(file_index);
+
+    /* the gitspace commits worth keeping are those reachable from a ref */
+    if (forest->git)
+	for (h = forest->git->heads; h; h = h->next) {
+	    (void)ptr_index_ref(&ref_index, h);
+	    /* PUNNING: see the big comment in cvs.h */
+	    gather_git_commits((git_commit *)h->commit);
+	}
+    for (t = all_tags; t; t = t->next)
+	gather_git_commits(t->commit);
+    PUT(git_index.count);
+    for (i = 0; i < git_index.count; i++) {
+	const git_commit *g = git_index.order[i];
+
+	/* PUNNING: see the big comment in cvs.h */
+	put_commit((const cvs_commit *)g, ptr_index_find(&git_index, g->parent));
+	revdir_save(&g->revdir);
+    }
+    revdir_checkpoint_done();
+
+    /* merge_to_changesets() returns no repository when it gives up */
+    nogit = forest->git == NULL;
+    PUT(nogit);
+    PUT(ref_index.count);
+    for (i = 0; i < ref_index.count; i++) {
+	const rev_ref *r = ref_index.order[i];
+	unsigned char depth = r->depth, degree = r->degree, flags = 0;
+
+	ref = ptr_index_find(&ref_index, r->parent);
+	PUT(ref);
+	ref = ptr_index_find(&git_index, r->commit);
+	PUT(ref);
+	put_string(r->ref_name);
+	put_number(r->number);
+	if (r->shown)
+	    flags |= REF_SHOWN;
+	if (r->tail)
+	    flags |= REF_TAIL;
+	PUT(depth);
+	PUT(degree);
+	PUT(flags);
+    }
+
+    n = tag_count;
+    PUT(n);
+    for (t = all_tags; t; t = t->next) {
+	put_string(t->name);
+	ref = ptr_index_find(&git_index, t->commit);
+	PUT(ref);
+	ref = ptr_index_find(&ref_index, t->parent);
+	PUT(ref);
+    }
+
+    for (i = 0; i < forest->filecount; i++) {
+	generator_t *gen = &forest->generators[i];
+	const packed_node_t *packed = generator_packed(gen);
+	int32_t expand = gen->expand;
+	n = packed ? gen->npacked : 0;
+	put_string(gen->master_name);
+	PUT(expand);
+	PUT(n);
+	PUT(gen->packed_head);
+	for (j = 0; j < n; j++) {
+	    const packed_node_t *pn = &packed[j];
+	    unsigned char flags = 0;
+
+	    put_number(pn->number);
+	    ref = pn->commit ? file_index(pn->commit) + 1 : 0;
+	    PUT(ref);
+	    put_string(pn->author);
+	    put_string(pn->state);
+	    put_string(pn->log);
+	    PUT(pn->offset);
+	    PUT(pn->length);
+	    PUT(pn->date);
+	    PUT(pn->to);
+	    PUT(pn->down);
+	    PUT(pn->sib);
+	    if (pn->has_version)
+		flags |= NODE_VERSION;
+	    if (pn->has_patch)
+		flags |= NODE_PATCH;
+	    if (pn->starts)
+		flags |= NODE_STARTS;
+	    PUT(flags);
+	}
+	generator_packed_done(gen, packed);
+    }
+
+    header.strings = ftello(checkpoint_fp);
+    PUT(string_index.count);
+    for (i = 0; i < string_index.count; i++) {
+	const char *s = string_index.order[i];
+	serial_t len = strlen(s);
+
+	PUT(len);
+	checkpoint_put(s, len + 1);
+    }
+    header.numbers = ftello(checkpoint_fp);
+    PUT(number_index.count);
+    for (i = 0; i < number_index.count; i++)
+	checkpoint_put(number_index.order[i], sizeof(cvs_number));
+
+    if (fseeko(checkpoint_fp, 0, SEEK_SET) != 0)
+	fatal_system_error("%s", path);
+    PUT(header);
+    if (fclose(checkpoint_fp) != 0)
+	fatal_system_error("%s", path);
+    checkpoint_fp = NULL;
+
+    free(commit_base);
+    ptr_index_free(&string_index);
+    ptr_index_free(&number_index);
+    ptr_index_free(&git_index);
+    ptr_index_free(&ref_index);
+}
+
+static const char *
+get_string(void)
+{
+    serial_t ref;
+
+    GET(ref);
+    if (ref > nstrings)
+	fatal_error("checkpoint string reference out of range");
+    return ref ? string_at[ref - 1] : NULL;
+}
+
+static const cvs_number *
+get_number(void)
+{
+    serial_t ref;
+
+    GET(ref);
+    if (ref > nnumbers)
+	fatal_error("checkpoint number reference out of range");
+    return ref ? number_at[ref - 1] : NULL;
+}
+
+static cvs_commit *
+file_at(serial_t ref)
+/* inverse of file_index() */
+{
+    if (ref >= ncommits)
+	fatal_error("checkpoint revision reference out of range");
+    return commit_at[ref];
+}
+
+static serial_t
+get_ref(const serial_t limit)
+/* read a 1-origin reference into a table of limit entries */
+{
+    serial_t ref;
+
+    GET(ref);
+    if (ref > limit)
+	fatal_error("checkpoint reference out of range");
+    return ref;
+}
+
+static serial_t
+get_commit(cvs_commit *c, const serial_t limit)
+/* read the members written by put_commit(), returning the parent reference */
+{
+    serial_t parent = get_ref(limit);
+    unsigned char flags;
+
+    c->log = get_string();
+    c->author = get_string();
+    c->commitid = get_string();
+    GET(c->date);
+    GET(c->serial);
+    GET(c->refcount);
+    GET(flags);
+    c->tail = (flags & COMMIT_TAIL) != 0;
+    c->tailed = (flags & COMMIT_TAILED) != 0;
+    c->dead = (flags & COMMIT_DEAD) != 0;
+    return parent;
+}
+
+void
+checkpoint_load(const char *path, forest_t *forest, const size_t memory_budget)
+/* rebuild a merged forest from a checkpoint file */
+{
+    checkpoint_header header;
+    uint16_t layout[6];
+    struct stat st;
+    char *map;
+    int fd;
+    serial_t i, j, n, ref, nrefs, ngits, ntags;
+    git_commit *gits;
+    rev_ref *refs;
+    tag_t **tail;
+    unsigned char nogit;
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+	fatal_system_error("%s", path);
+    if (st.st_size < (off_t)sizeof(header))
+	fatal_error("%s: not a checkpoint file", path);
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+	fatal_system_error("mmap: %s", path);
+    close(fd);
+    checkpoint_end = map + st.st_size;
+
+    memcpy(&header, map, sizeof(header));
+    checkpoint_layout(layout);
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0)
+	fatal_error("%s: not a checkpoint file", path);
+    if (header.version != CHECKPOINT_VERSION
+	|| memcmp(header.layout, layout, sizeof(layout)) != 0)
+	fatal_error("%s: checkpoint was written by an incompatible build", path);
+    if (header.strings > (uint64_t)st.st_size || header.numbers > (uint64_t)st.st_size)
+	fatal_error("checkpoint file is truncated");
+
+    path_trie_init();
+
+    checkpoint_in = map + header.strings;
+    GET(nstrings);
+    string_at = xmalloc(nstrings * sizeof(char *), __func__);
+    for (i = 0; i < nstrings; i++) {
+	serial_t len;
+
+	GET(len);
+	if ((size_t)(checkpoint_end - checkpoint_in) <= len || checkpoint_in[len] != '\0')
+	    fatal_error("checkpoint file is truncated");
+	string_at[i] = atom(checkpoint_in);
+	checkpoint_in += len + 1;
+    }
+    checkpoint_in = map + header.numbers;
+    GET(nnumbers);
+    number_at = xmalloc(nnumbers * sizeof(cvs_number *), __func__);
+    for (i = 0; i < nnumbers; i++) {
+	cvs_number number;
+
+	GET(number);
+	number_at[i] = atom_cvs_number(number);
+    }
+
+    checkpoint_in = map + sizeof(header);
+    GET(forest->filecount);
+    GET(forest->textsize);
+    GET(forest->errcount);
+    GET(forest->skew_vulnerable);
+    GET(forest->total_revisions);
+
+    forest->masters = xcalloc(forest->filecount, sizeof(rev_master), "rev_masters");
+    ncommits = 0;
+    for (i = 0; i < forest->filecount; i++) {
+	rev_master *m = &forest->masters[i];
+	const char *dir;
+	uint32_t mode;
+
+	m->name = get_string();
+	m->fileop_name = get_string();
+	dir = get_string();
+	m->dir = dir ? path_trie_dir(dir) : NULL;
+	GET(mode);
+	m->mode = mode;
+	GET(m->ncommits);
+	m->commits = commit_pool_alloc(m->ncommits, &m->commit_base);
+	ncommits += m->ncommits;
+    }
+    commit_at = xmalloc(ncommits * sizeof(cvs_commit *), __func__);
+    for (i = 0, n = 0; i < forest->filecount; i++)
+	for (j = 0; j < forest->masters[i].ncommits; j++)
+	    commit_at[n++] = &forest->masters[i].commits[j];
+    for (i = 0; i < ncommits; i++) {
+	cvs_commit *c = commit_at[i];
+	unsigned char emitted;
+
+	ref = get_commit(c, ncommits);
+	c->parent = ref ? commit_at[ref - 1] : NULL;
+	GET(emitted);
+	c->emitted = (emitted & COMMIT_EMITTED) != 0;
+	GET(c->hash);
+	c->number = get_number();
+    }
+    for (i = 0; i < forest->filecount; i++)
+	for (j = 0; j < forest->masters[i].ncommits; j++) {
+	    forest->masters[i].commits[j].master = &forest->masters[i];
+	    forest->masters[i].commits[j].dir = forest->masters[i].dir;
+	}
+    revdir_load_packs(file_at);
+
+    GET(ngits);
+    gits = xcalloc(ngits, sizeof(git_commit), "git commits");
+    for (i = 0; i < ngits; i++) {
+	/* PUNNING: see the big comment in cvs.h */
+	ref = get_commit((cvs_commit *)&gits[i], ngits);
+	gits[i].parent = ref ? &gits[ref - 1] : NULL;
+	revdir_load(&gits[i].revdir);
+    }
+    revdir_checkpoint_done();
+
+    GET(nogit);
+    GET(nrefs);
+    refs = xcalloc(nrefs, sizeof(rev_ref), "rev_ref");
+    for (i = 0; i < nrefs; i++) {
+	rev_ref *r = &refs[i];
+	unsigned char depth, degree, flags;
+
+	r->next = i + 1 < nrefs ? &refs[i + 1] : NULL;
+	ref = get_ref(nrefs);
+	r->parent = ref ? &refs[ref - 1] : NULL;
+	ref = get_ref(ngits);
+	/* PUNNING: see the big comment in cvs.h */
+	r->commit = ref ? (cvs_commit *)&gits[ref - 1] : NULL;
+	r->ref_name = get_string();
+	r->number = get_number();
+	GET(depth);
+	GET(degree);
+	GET(flags);
+	r->depth = depth;
+	r->degree = degree;
+	r->shown = (flags & REF_SHOWN) != 0;
+	r->tail = (flags & REF_TAIL) != 0;
+    }
+    if (nogit)
+	forest->git = NULL;
+    else {
+	forest->git = xcalloc(1, sizeof(git_repo), "git repo");
+	forest->git->heads = nrefs ? refs : NULL;
+    }
+    forest->cvs = NULL;
+
+    GET(ntags);
+    tail = &all_tags;
+    for (i = 0; i < ntags; i++) {
+	tag_t *t = xcalloc(1, sizeof(tag_t), "tag lookup");
+
+	t->name = get_string();
+	ref = get_ref(ngits);
+	t->commit = ref ? &gits[ref - 1] : NULL;
+	ref = get_ref(nrefs);
+	t->parent = ref ? &refs[ref - 1] : NULL;
+	*tail = t;
+	tail = &t->next;
+    }
+    tag_count = ntags;
+
+    forest->generators = xcalloc(forest->filecount, sizeof(generator_t), "Generators");
+    for (i = 0; i < forest->filecount; i++) {
+	generator_t *gen = &forest->generators[i];
+	packed_node_t *packed = NULL;
+	int32_t expand;
+	serial_t head;
+
+	gen->master_name = get_string();
+	GET(expand);
+	gen->expand = expand;
+	GET(n);
+	GET(head);
+	if (head > n)
+	    fatal_error("checkpoint node reference out of range");
+	if (n > 0)
+	    packed = xmalloc(n * sizeof(packed_node_t), "packed generator");
+	for (j = 0; j < n; j++) {
+	    packed_node_t *pn = &packed[j];
+	    unsigned char flags;
+
+	    pn->number = get_number();
+	    ref = get_ref(ncommits);
+	    pn->commit = ref ? commit_at[ref - 1] : NULL;
+	    pn->author = get_string();
+	    pn->state = get_string();
+	    pn->log = get_string();
+	    GET(pn->offset);
+	    GET(pn->length);
+	    GET(pn->date);
+	    pn->to = get_ref(n);
+	    pn->down = get_ref(n);
+	    pn->sib = get_ref(n);
+	    GET(flags);
+	    pn->has_version = (flags & NODE_VERSION) != 0;
+	    pn->has_patch = (flags & NODE_PATCH) != 0;
+	    pn->starts = (flags & NODE_STARTS) != 0;
+	}
+	generator_adopt(gen, packed, n, head, memory_budget);
+    }
+
+    munmap(map, st.st_size);
+    checkpoint_in = checkpoint_end = NULL;
+    free(string_at);
+    free(number_at);
+    free(commit_at);
+}
+
+/* end */
@@ -0,0 +1,334 @@
+/*
+ * Compress the output stream as gzip, in parallel blocks.
+ *
+ * compress_begin() forks a compressor before any output is written and
+ * points standard output at a pipe into it, so everything the program
+ * writes there, whether through stdio, writev() or vmsplice(), is
+ * compressed without the emitters knowing.  The compressor cuts the
+ * stream into blocks of COMPRESS_BLOCK bytes and deflates each into a
+ * gzip member of its own.  Concatenated members are a valid gzip file,
+ * so gunzip and zcat read the result as one stream.
+ *
+ * With threads, the blocks go through a ring of two slots per worker:
+ * the compressor's main thread reads the pipe into free slots, the
+ * workers deflate them in any order, and a writer thread puts the
+ * members out in sequence.  There is a worker per processor, up to
+ * COMPRESS_WORKERS, whatever -t says, so the ring never holds more
+ * than about 2MB per worker.  A full ring holds back the reader, so
+ * the pipe and then the exporter wait for the compressor rather than
+ * the other way around.  Without threads the compressor deflates one
+ * block at a time, which still overlaps compression with export.
+ *
+ * Restarting the dictionary at every block costs about one percent of
+ * ratio at this block size, in exchange for blocks that can be
+ * compressed independently.
+ */
+
+#include "cvs.h"
+
+#ifdef ZLIB
+#include <unistd.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
+
+#define COMPRESS_BLOCK	(1024*1024)
+#define COMPRESS_WORKERS	8	/* at two 1MB slots each, caps the ring at 16MB */
+#define GZIP_WINDOW	(15 + 16)	/* 32K window, gzip wrapper */
+
+typedef struct _compress_block {
+    unsigned char	*in, *out;
+    size_t		inlen, outlen;
+    bool		done;
+} compress_block;
+
+static pid_t compressor;
+static size_t outsize;		/* deflate's bound on a member */
+
+static void
+deflate_init(z_stream *z)
+/* set up a stream to make gzip members */
+{
+    memset(z, '\0', sizeof(z_stream));
+    if (deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW, 8,
+		     Z_DEFAULT_STRATEGY) != Z_OK)
+	fatal_error("cannot initialize zlib: %s", z->msg ? z->msg : "no memory");
+}
+
+static void
+deflate_block(z_stream *z, compress_block *b)
+/* make one block into a complete gzip member */
+{
+    if (deflateReset(z) != Z_OK)
+	fatal_error("zlib reset failed");
+    z->next_in = b->in;
+    z->avail_in = b->inlen;
+    z->next_out = b->out;
+    z->avail_out = outsize;
+    /* the output buffer is deflate's bound, so one call finishes */
+    if (deflate(z, Z_FINISH) != Z_STREAM_END)
+	fatal_error("zlib deflate failed: %s", z->msg ? z->msg : "buffer full");
+    b->outlen = outsize - z->avail_out;
+}
+
+static size_t
+read_block(int fd, compress_block *b)
+/* fill a block from the pipe; short only at end of input */
+{
+    b->inlen = 0;
+    while (b->inlen < COMPRESS_BLOCK) {
+	ssize_t n = read(fd, b->in + b->inlen, COMPRESS_BLOCK - b->inlen);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fatal_system_error("reading the stream to compress");
+	}
+	if (n == 0)
+	    break;
+	b->inlen += n;
+    }
+    return b->inlen;
+}
+
+static void
+write_block(const compress_block *b)
+/* write a finished member to the real standard output */
+{
+    const unsigned char *p = b->out;
+    size_t left = b->outlen;
+
+    while (left > 0) {
+	ssize_t n = write(STDOUT_FILENO, p, left);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fatal_system_error("writing compressed output");
+	}
+	p += n;
+	left -= n;
+    }
+}
+
+static void
+block_alloc(compress_block *b)
+{
+    b->in = xmalloc(COMPRESS_BLOCK, "compress");
+    b->out = xmalloc(outsize, "compress");
+}
+
+static void
+compress_serial(int fd)
+/* deflate and write one block at a time */
+{
+    compress_block	b;
+    z_stream		z;
+    unsigned long	nblocks = 0;
+
+    deflate_init(&z);
+    block_alloc(&b);
+    /* empty input still makes one (empty) member, so gunzip accepts it */
+    while (read_block(fd, &b) > 0 || nblocks == 0) {
+	deflate_block(&z, &b);
+	write_block(&b);
+	nblocks++;
+    }
+    deflateEnd(&z);
+}
+
+#ifdef THREADS
+static compress_block *ring;
+static unsigned nslots;
+/* blocks [next_out, next_work) are being deflated or done, up to next_in full */
+static unsigned long next_in, next_work, next_out;
+static bool eof;
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+
+static void *
+compress_worker(void *arg)
+/* take full blocks in order and deflate them */
+{
+    z_stream	z;
+
+    deflate_init(&z);
+    for (;;) {
+	compress_block *b;
+
+	pthread_mutex_lock(&ring_mutex);
+	while (next_work == next_in && !eof)
+	    pthread_cond_wait(&ring_cond, &ring_mutex);
+	if (next_work == next_in) {
+	    pthread_mutex_unlock(&ring_mutex);
+	    break;
+	}
+	b = &ring[next_work++ % nslots];
+	pthread_mutex_unlock(&ring_mutex);
+
+	deflate_block(&z, b);
+
+	pthread_mutex_lock(&ring_mutex);
+	b->done = true;
+	pthread_cond_broadcast(&ring_cond);
+	pthread_mutex_unlock(&ring_mutex);
+    }
+    deflateEnd(&z);
+    return NULL;
+}
+
+static void *
+compress_writer(void *arg)
+/* put the members out in stream order, freeing their slots */
+{
+    for (;;) {
+	compress_block *b;
+
+	pthread_mutex_lock(&ring_mutex);
+	while (!(next_out < next_in && ring[next_out % nslots].done)) {
+	    if (eof && next_out == next_in) {
+		pthread_mutex_unlock(&ring_mutex);
+		return NULL;
+	    }
+	    pthread_cond_wait(&ring_cond, &ring_mutex);
+	}
+	b = &ring[next_out % nslots];
+	pthread_mutex_unlock(&ring_mutex);
+
+	write_block(b);
+
+	pthread_mutex_lock(&ring_mutex);
+	next_out++;
+	pthread_cond_broadcast(&ring_cond);
+	pthread_mutex_unlock(&ring_mutex);
+    }
+}
+
+static void
+compress_threaded(int fd, int nworkers)
+/* read blocks into the ring for the workers and the writer */
+{
+    pthread_t	*workers = xcalloc(nworkers, sizeof(pthread_t), "compress");
+    pthread_t	writer;
+    unsigned	i;
+
+    nslots = 2 * nworkers;
+    ring = xcalloc(nslots, sizeof(compress_block), "compress");
+    for (i = 0; i < nslots; i++)
+	block_alloc(&ring[i]);
+    for (i = 0; i < nworkers; i++)
+	if (pthread_create(&workers[i], NULL, compress_worker, NULL) != 0)
+	    fatal_error("compressor thread creation failed");
+    if (pthread_create(&writer, NULL, compress_writer, NULL) != 0)
+	fatal_error("compressor thread creation failed");
+
+    for (;;) {
+	compress_block	*b;
+	size_t		len;
+
+	pthread_mutex_lock(&ring_mutex);
+	while (next_in - next_out == nslots)
+	    pthread_cond_wait(&ring_cond, &ring_mutex);
+	b = &ring[next_in % nslots];
+	pthread_mutex_unlock(&ring_mutex);
+
+	/* the slot is ours until next_in passes it */
+	len = read_block(fd, b);
+
+	pthread_mutex_lock(&ring_mutex);
+	if (len > 0 || next_in == 0) {
+	    b->done = false;
+	    next_in++;
+	}
+	if (len < COMPRESS_BLOCK)
+	    eof = true;
+	pthread_cond_broadcast(&ring_cond);
+	pthread_mutex_unlock(&ring_mutex);
+	if (len < COMPRESS_BLOCK)
+	    break;
+    }
+
+    for (i = 0; i < nworkers; i++)
+	pthread_join(workers[i], NULL);
+    pthread_join(writer, NULL);
+}
+#endif /* THREADS */
+
+bool
+compress_end(void)
+/* end the stream to the compressor and wait for it; false if it failed */
+{
+    int status;
+
+    if (compressor <= 0)
+	return true;
+    fflush(stdout);
+    close(STDOUT_FILENO);
+    while (waitpid(compressor, &status, 0) < 0)
+	if (errno != EINTR) {
+	    status = -1;
+	    break;
+	}
+    compressor = 0;
+    return status == 0;
+}
+
+static void
+compress_atexit(void)
+/* on the way out after a fatal error, still finish what was written */
+{
+    if (!compress_end())
+	announce("the compressor failed; output is incomplete.\n");
+}
+
+void
+compress_begin(bool threaded)
+/* send standard output through a gzip compressor from here on */
+{
+    int		fds[2];
+    z_stream	z;
+#ifdef THREADS
+    int		nworkers = COMPRESS_WORKERS;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    if (sysconf(_SC_NPROCESSORS_ONLN) < nworkers)
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* _SC_NPROCESSORS_ONLN */
+    if (nworkers < 1)
+	nworkers = 1;
+#endif /* THREADS */
+
+    deflate_init(&z);
+    outsize = deflateBound(&z, COMPRESS_BLOCK);
+    deflateEnd(&z);
+
+    if (pipe(fds) != 0)
+	fatal_system_error("cannot make the compression pipe");
+    fflush(stdout);
+    compressor = fork();
+    if (compressor < 0)
+	fatal_system_error("cannot start the compressor");
+    if (compressor == 0) {
+	/* the child keeps the real standard output */
+	close(fds[1]);
+#ifdef THREADS
+	if (threaded)
+	    compress_threaded(fds[0], nworkers);
+	else
+#endif /* THREADS */
+	    compress_serial(fds[0]);
+	_exit(0);
+    }
+
+    if (dup2(fds[1], STDOUT_FILENO) < 0)
+	fatal_system_error("cannot redirect output to the compressor");
+    close(fds[0]);
+    close(fds[1]);
+    atexit(compress_atexit);
+}
+
+#endif /* ZLIB */
+
+/* end */
@@ -61,7 +61,6 @@ struct _cvs_version;
 struct _cvs_patch;
 
 typedef struct node {
-    struct node *hash_next;
     struct _cvs_version *version;
     struct _cvs_patch *patch;
     struct _cvs_commit *commit;
@@ -73,10 +72,9 @@ typedef struct node {
     flag starts;
 } node_t;
 
-#define NODE_HASH_SIZE	97
-
 typedef struct nodehash {
-    node_t *table[NODE_HASH_SIZE];
+    node_t **table;	/* open-addressed on the number atom, see nodehash.c */
+    size_t mask;	/* slots - 1; the table grows with the master */
     int nentries;
     node_t *head_node;
 } nodehash_t;
@@ -205,6 +203,22 @@ typedef struct _editbuffer {
 #define Gnode_text(eb) eb->current->node_text
 #define Ginbuf(eb) (&eb->in_buffer_store)
 
+#define NO_NODE	0	/* packed node links are 1-origin so 0 means none */
+
+typedef struct _packed_node {
+    /* flattened node_t plus its version and patch, see genpack.c */
+    const cvs_number	*number;
+    struct _cvs_commit	*commit;
+    const char		*author;
+    const char		*state;
+    const char		*log;
+    off_t		offset;
+    size_t		length;
+    cvstime_t		date;
+    serial_t		to, down, sib;
+    flag		has_version, has_patch, starts;
+} packed_node_t;
+
 typedef struct _generator {
     /* isolare parts of a CVS file context required for snapshot generation */
     const char		*master_name;
@@ -212,16 +226,47 @@ typedef struct _generator {
     cvs_version		*versions;
     cvs_patch		*patches;
     nodehash_t		nodehash;
-    editbuffer_t	editbuffer;
+    /* compact form used in memory-budget mode, see genpack.c */
+    void		*packed;	/* NULL when spilled to disk */
+    off_t		spill_offset;
+    void		*slab;		/* storage of a rehydrated generator */
+    serial_t		npacked;
+    serial_t		packed_head;
 } generator_t;
 
+typedef struct _version_branch {
+    /* a run of cvs_file.branch_versions on one branch, see nodehash.c */
+    const cvs_number	*key;		/* cvs_branch_key() of each of them */
+    serial_t		first, count;
+} version_branch;
+
+enum digest_phase {
+    digest_build, digest_vendor, digest_graft, digest_refs, digest_sort,
+    digest_tail, DIGEST_PHASES
+};
+
+typedef struct _digest_stats {
+    /* where cvs_master_digest() spent its time, gathered under -p */
+    double		seconds[DIGEST_PHASES];
+    serial_t		nversions;
+    int			nheads, nsymbols;
+} digest_stats;
+
 typedef struct {
     /* this represents the entire metadata content of a CVS master file */
     const char		*export_name;
     cvs_symbol		*symbols;
-#ifdef REDBLACK
+#if defined(SYMINDEX)
+    cvs_symbol		**symbol_index;	/* see cvs_find_symbol() */
+    size_t		symbol_mask;
+#elif defined(REDBLACK)
     struct rbtree_node	*symbols_by_name;
-#endif /* REDBLACK */
+#endif /* SYMINDEX */
+    struct _cvs_commit	**revision_index;	/* see cvs_master_find_revision() */
+    size_t		revision_mask;
+    cvs_version		**branch_versions;	/* see cvs_find_version() */
+    version_branch	*branch_index;
+    size_t		branch_mask;
     const char		*description;
     generator_t		gen;
     const cvs_number	*head;
@@ -230,14 +275,31 @@ typedef struct {
     serial_t		nversions;
     mode_t		mode;
     unsigned short	verbose;
+    struct _tag_stage	*tag_stage;	/* the digesting worker's, see tags.c */
+    digest_stats	digest;
 } cvs_file;
 
 typedef struct _master_dir {
     /* directory reference for a master */
     const char          *name;
     const struct _master_dir *parent;
+    serial_t		index;		/* position in master_dirs[] */
 } master_dir;
 
+typedef struct _path_node {
+    /* a directory or file in the trie of master names, see pathtrie.c */
+    master_dir		dir;		/* directories: full name and parent */
+    const char		*name;		/* last component, not terminated */
+    const char		*fileop_name;	/* files: name in the fileops */
+    struct _path_node	*parent;
+    struct _path_node	*subdirs, *files, *sibling;
+    struct _path_node	*hash_next;
+    size_t		nmasters;	/* files: masters rectified to this name */
+    size_t		slot;		/* files: next index in path order */
+    unsigned short	len;
+    bool		isdir;
+} path_node;
+
 typedef struct _rev_master {
     /* information shared by all revisions of a master */
     const char		*name;
@@ -245,6 +307,7 @@ typedef struct _rev_master {
     const master_dir    *dir;
     struct _cvs_commit  *commits;
     serial_t		ncommits;
+    serial_t		commit_base;	/* handle of commits[0] */
     mode_t		mode;
 } rev_master;
 
@@ -330,6 +393,36 @@ typedef struct _cvs_commit {
     const cvs_number	*number;
 } cvs_commit;
 
+/*
+ * Every master's slab of revisions is carved out of one commit pool,
+ * so a CVS revision can also be named by a 32-bit handle, which is
+ * what revdir file lists and the merge's working arrays store.  The
+ * pool is a table of fixed-size chunks; a handle is a chunk number and
+ * an offset.  Handle 0 is never given out and stands for no commit.
+ * A master's slab is contiguous in memory and in handles, so a
+ * revision's handle is its offset from the slab's base.
+ */
+typedef uint32_t	commit_handle;
+
+#define COMMIT_CHUNK_BITS	14
+#define COMMIT_CHUNK_SIZE	(1U << COMMIT_CHUNK_BITS)
+/* handles are kept to 31 bits so the merge can pack a flag beside one */
+#define COMMIT_MAX_CHUNKS	(1U << (31 - COMMIT_CHUNK_BITS))
+
+extern cvs_commit *commit_chunks[COMMIT_MAX_CHUNKS];
+
+static inline cvs_commit *
+cvs_commit_at(const commit_handle h)
+{
+    return &commit_chunks[h >> COMMIT_CHUNK_BITS][h & (COMMIT_CHUNK_SIZE - 1)];
+}
+
+static inline commit_handle
+cvs_commit_handle(const cvs_commit *c)
+{
+    return c->master->commit_base + (commit_handle)(c - c->master->commits);
+}
+
 typedef struct _git_commit {
     /* a gitspace changeset */
     struct _git_commit	*parent;
@@ -464,7 +557,18 @@ cvstime_t
 lex_date(const cvs_number *n, void *, cvs_file *cvs);
 
 void
-atom_dir_init(void);
+path_trie_init(void);
+
+path_node *
+path_trie_insert(const char *rectified);
+
+const master_dir *
+path_trie_dir(const char *dirname);
+
+extern const master_dir **master_dirs;
+
+size_t
+path_trie_order(void);
 
 void
 cvs_master_digest(cvs_file *cvs, cvs_master *cm, rev_master *master);
@@ -496,17 +600,32 @@ typedef struct _forest {
     off_t textsize;
     int errcount;
     cvs_master *cvs;
+    rev_master *masters;
     git_repo *git;
     generator_t *generators;
     cvstime_t skew_vulnerable;
     unsigned int total_revisions;
 } forest_t;
 
+typedef struct _staged_tag {
+	cvs_commit *commit;
+	const char *name;
+} staged_tag;
+
+typedef struct _tag_stage {
+	/* one worker's tags, held back until the master order is settled */
+	staged_tag *tags;
+	size_t count;
+	size_t alloc;
+} tag_stage;
+
 extern tag_t  *all_tags;
 extern size_t tag_count;
 extern const master_dir *root_dir;
 
 void tag_commit(cvs_commit *c, const char *name, cvs_file *cvsfile);
+void tag_replay(const tag_stage *stage, size_t first, size_t count,
+		const char *master_name);
 cvs_commit **tagged(tag_t *tag);
 void discard_tags(void);
 
@@ -514,6 +633,8 @@ typedef struct _import_options {
     bool promiscuous;
     int verbose;
     ssize_t striplen;
+    size_t memory_budget;
+    const char *walk_root;
 } import_options_t;
 
 typedef struct _export_options {
@@ -525,7 +646,10 @@ typedef struct _export_options {
     bool reposurgeon;
     bool embed_ids;
     bool force_dates;
-    enum {adaptive, fast, canonical} reportmode;
+    enum {adaptive, fast, streaming, canonical} reportmode;
+    size_t blob_budget;		/* canonical blobs held in core, see export.c */
+    const char *shard_dir;	/* split fast order into streams here */
+    int shards;			/* besides the trunk stream */
     bool authorlist;
     bool progress;
 } export_options_t;
@@ -546,6 +670,9 @@ cvs_is_head(const cvs_number *n);
 bool
 cvs_same_branch(const cvs_number *a, const cvs_number *b);
 
+const cvs_number *
+cvs_branch_key(const cvs_number *n);
+
 bool
 cvs_number_equal(const cvs_number *n1, const cvs_number *n2);
 
@@ -573,6 +700,9 @@ cvs_branch_head(cvs_file *f, const cvs_number *branch);
 const cvs_number
 cvs_branch_parent(cvs_file *f, const cvs_number *branch);
 
+void
+cvs_version_index(cvs_file *cvs);
+
 node_t *
 cvs_find_version(const cvs_file *cvs, const cvs_number *number);
 
@@ -585,9 +715,31 @@ cvs_is_vendor(const cvs_number *number);
 void
 cvs_file_free(cvs_file *cvs);
 
+cvs_commit *
+commit_pool_alloc(const size_t n, commit_handle *base);
+
 void
 generator_free(generator_t *gen);
 
+void
+generator_compact(generator_t *gen, const size_t budget);
+
+void
+generator_expand(generator_t *gen);
+
+const packed_node_t *
+generator_packed(generator_t *gen);
+
+void
+generator_packed_done(const generator_t *gen, const packed_node_t *packed);
+
+void
+generator_discard(generator_t *gen);
+
+void
+generator_adopt(generator_t *gen, packed_node_t *packed,
+		const serial_t n, const serial_t head, const size_t budget);
+
 char *
 cvs_number_string(const cvs_number *n, char *str, size_t maxlen);
 
@@ -631,6 +783,9 @@ discard_atoms(void);
 rev_ref *
 rev_list_add_head(head_list *rl, cvs_commit *commit, const char *name, int degree);
 
+rev_ref *
+rev_list_append_head(rev_ref ***tail, cvs_commit *commit, const char *name, int degree);
+
 rev_diff *
 git_commit_diff(git_commit *old, git_commit *new);
 
@@ -658,8 +813,38 @@ void
 free_author_map(void);
 
 void
-generate_files(generator_t *gen, export_options_t *opts,
-	       void (*hook)(node_t *node, void *buf, size_t len, export_options_t *popts));
+checkpoint_save(const char *path, forest_t *forest);
+
+void
+checkpoint_load(const char *path, forest_t *forest, const size_t memory_budget);
+
+void
+checkpoint_put(const void *buf, const size_t len);
+
+void
+checkpoint_get(void *buf, const size_t len);
+
+#ifdef ZLIB
+void
+compress_begin(bool threaded);
+
+bool
+compress_end(void);
+#endif /* ZLIB */
+
+typedef struct _blob_sink {
+    /*
+     * Takes each snapshot in pieces, its length given up front.  If
+     * mapped is set, every piece of it will point into a master's text
+     * map, which is never written and outlives the snapshot.
+     */
+    void (*begin)(node_t *node, size_t len, bool mapped, export_options_t *opts);
+    void (*write)(const void *buf, size_t len, export_options_t *opts);
+    void (*end)(node_t *node, export_options_t *opts);
+} blob_sink;
+
+void
+generate_stream(generator_t *gen, export_options_t *opts, const blob_sink *sink);
 
 /* xnew(T) allocates aligned (packed) storage. It never returns NULL */
 #define xnew(T, legend) \
@@ -687,6 +872,16 @@ xcalloc(size_t, size_t, char const *legend) _alloclike2(1,2) _malloclike;
 void* 
 xrealloc(void *ptr, size_t size, char const *legend) _alloclike(2);
 
+#ifdef MEMSTATS
+/* account for the x*alloc() family by legend; see memstats.c */
+void memstats_alloc(const void *, size_t, const char *);
+void memstats_free(const void *);
+void memstats_phase(const char *);
+void memstats_report(FILE *);
+void xfree(void *);
+#define free(ptr)	xfree(ptr)
+#endif /* MEMSTATS */
+
 void
 announce(char const *format,...) _printflike(1, 2);
 
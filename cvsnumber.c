@@ -75,6 +75,30 @@ cvs_same_branch(const cvs_number *a, const cvs_number *b)
     return true;
 }
 
+const cvs_number *
+cvs_branch_key(const cvs_number *n)
+/*
+ * The branch a revision or branch number is on, as an atom, such that
+ * cvs_same_branch(a, b) is cvs_branch_key(a) == cvs_branch_key(b).
+ * Numbers of revisions (1.2.3.4) and of their branches (1.2.3 and the
+ * magic 1.2.0.3) all give 1.2.3; everything on the trunk gives 0.
+ */
+{
+    cvs_number	k;
+
+    if (n->c == 0)
+	return atom_cvs_number(*n);
+    k = *n;
+    if ((k.c & 1) == 0) {
+	k.c--;
+	if (k.n[k.c - 1] == 0)
+	    k.n[k.c - 1] = n->n[k.c];
+    }
+    if (k.c == 1)
+	k.n[0] = 0;
+    return atom_cvs_number(k);
+}
+
 bool
 cvs_number_equal(const cvs_number *n1, const cvs_number *n2) {
     /* can use memcmp as cvs_number isn't padded */
@@ -22,6 +22,9 @@
 #include "rbtree.h"
 #endif /* REDBLACK */
 #include "cvs.h"
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
 
 static void
 cvs_symbol_free(cvs_symbol *symbol)
@@ -76,8 +79,12 @@ void
 generator_free(generator_t *gen)
 {
     cvs_version_free(gen->versions);
+    gen->versions = NULL;
     cvs_patch_free(gen->patches);
+    gen->patches = NULL;
     clean_hash(&gen->nodehash);
+    free(gen->slab);
+    gen->slab = NULL;
 }
 
 void
@@ -85,10 +92,67 @@ cvs_file_free(cvs_file *cvs)
 /* discard a file object and its storage */
 {
     cvs_symbol_free(cvs->symbols);
-#ifdef REDBLACK
+#if defined(SYMINDEX)
+    free(cvs->symbol_index);
+#elif defined(REDBLACK)
     rbtree_free(cvs->symbols_by_name);
-#endif /* REDBLACK */
+#endif /* SYMINDEX */
+    free(cvs->revision_index);
+    free(cvs->branch_versions);
+    free(cvs->branch_index);
     free(cvs);
 }
 
+/* see cvs.h for how handles map onto the pool */
+cvs_commit *commit_chunks[COMMIT_MAX_CHUNKS];
+static serial_t commit_nchunks;		/* chunk numbers given out */
+static serial_t commit_chunk;		/* chunk small slabs come from */
+static serial_t commit_fill;		/* revisions used in it */
+#ifdef THREADS
+static pthread_mutex_t commit_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif /* THREADS */
+
+cvs_commit *
+commit_pool_alloc(const size_t n, commit_handle *base)
+/* carve a zeroed, contiguous slab of n revisions out of the commit pool */
+{
+    cvs_commit	*slab;
+    serial_t	nchunks, j;
+
+#ifdef THREADS
+    pthread_mutex_lock(&commit_pool_mutex);
+#endif /* THREADS */
+    if (commit_nchunks == 0) {
+	commit_chunks[0] = xcalloc(COMMIT_CHUNK_SIZE, sizeof(cvs_commit),
+				   "commit slab alloc");
+	commit_nchunks = 1;
+	commit_fill = 1;	/* handle 0 means no commit */
+    }
+    if (n <= COMMIT_CHUNK_SIZE - commit_fill) {
+	slab = commit_chunks[commit_chunk] + commit_fill;
+	*base = (commit_chunk << COMMIT_CHUNK_BITS) | commit_fill;
+	commit_fill += n;
+    } else {
+	/* fresh chunks, as many as it takes, in one block */
+	nchunks = (n + COMMIT_CHUNK_SIZE - 1) / COMMIT_CHUNK_SIZE;
+	if (nchunks > COMMIT_MAX_CHUNKS - commit_nchunks)
+	    fatal_error("too many CVS revisions for the commit pool");
+	slab = xcalloc((size_t)nchunks * COMMIT_CHUNK_SIZE, sizeof(cvs_commit),
+		       "commit slab alloc");
+	for (j = 0; j < nchunks; j++)
+	    commit_chunks[commit_nchunks + j] = slab + (size_t)j * COMMIT_CHUNK_SIZE;
+	*base = commit_nchunks << COMMIT_CHUNK_BITS;
+	/* keep filling whichever chunk has more room left */
+	if (nchunks * COMMIT_CHUNK_SIZE - n > COMMIT_CHUNK_SIZE - commit_fill) {
+	    commit_chunk = commit_nchunks + nchunks - 1;
+	    commit_fill = n - (nchunks - 1) * COMMIT_CHUNK_SIZE;
+	}
+	commit_nchunks += nchunks;
+    }
+#ifdef THREADS
+    pthread_mutex_unlock(&commit_pool_mutex);
+#endif /* THREADS */
+    return slab;
+}
+
 /* end */
@@ -7,7 +7,7 @@
 struct _file_list {
     /* a directory containing a collection of file states */
     serial_t   nfiles;
-    cvs_commit *files[0];
+    commit_handle files[0];
 };
 
 typedef struct _file_list_hash {
@@ -19,20 +19,20 @@ typedef struct _file_list_hash {
 static file_list_hash	*buckets[REV_DIR_HASH];
 
 static hash_t
-hash_files(const cvs_commit *const * const files, const int nfiles)
+hash_files(const commit_handle * const files, const int nfiles)
 /* hash a file list so we can recognize it cheaply */
 {
     hash_t h = 0;
     size_t i;
     /* Combine existing hashes rather than computing new ones */
     for (i = 0; i < nfiles; i++)
-	h = HASH_COMBINE(h, files[i]->hash);
+	h = HASH_COMBINE(h, cvs_commit_at(files[i])->hash);
 
     return h;
 }
 
 static file_list *
-pack_file_list(const cvs_commit * const * const files, const int nfiles)
+pack_file_list(const commit_handle * const files, const int nfiles)
 /* pack a collection of file revisions for space efficiency */
 {
     hash_t         hash = hash_files(files, nfiles);
@@ -42,18 +42,18 @@ pack_file_list(const cvs_commit * const * const files, const int nfiles)
     /* avoid packing a file list if we've done it before */ 
     for (h = *bucket; h; h = h->next) {
 	if (h->hash == hash && h->fl.nfiles == nfiles &&
-	    !memcmp(files, h->fl.files, nfiles * sizeof(cvs_commit *)))
+	    !memcmp(files, h->fl.files, nfiles * sizeof(commit_handle)))
 	{
 	    return &h->fl;
 	}
     }
-    h = xmalloc(sizeof(file_list_hash) + nfiles * sizeof(cvs_commit *),
+    h = xmalloc(sizeof(file_list_hash) + nfiles * sizeof(commit_handle),
 		 __func__);
     h->next = *bucket;
     *bucket = h;
     h->hash = hash;
     h->fl.nfiles = nfiles;
-    memcpy(h->fl.files, files, nfiles * sizeof(cvs_commit *));
+    memcpy(h->fl.files, files, nfiles * sizeof(commit_handle));
     return &h->fl;
 }
 
@@ -91,6 +91,92 @@ revdir_free(void)
     }
 }
 
+void
+revdir_save_packs(serial_t (*file_index)(const cvs_commit *))
+{
+    size_t i;
+    serial_t n = 0, j, k, ref;
+    file_list_hash *h;
+
+    for (i = 0; i < REV_DIR_HASH; i++)
+	for (h = buckets[i]; h; h = h->next)
+	    n++;
+    checkpoint_packs = xmalloc(n * sizeof(void *), __func__);
+    checkpoint_npacks = 0;
+    for (i = 0; i < REV_DIR_HASH; i++)
+	for (h = buckets[i]; h; h = h->next)
+	    checkpoint_packs[checkpoint_npacks++] = h;
+    qsort(checkpoint_packs, n, sizeof(void *), compare_address);
+
+    checkpoint_put(&n, sizeof(n));
+    for (j = 0; j < n; j++) {
+	h = checkpoint_packs[j];
+	checkpoint_put(&h->hash, sizeof(h->hash));
+	checkpoint_put(&h->fl.nfiles, sizeof(h->fl.nfiles));
+	for (k = 0; k < h->fl.nfiles; k++) {
+	    ref = file_index(cvs_commit_at(h->fl.files[k]));
+	    checkpoint_put(&ref, sizeof(ref));
+	}
+    }
+}
+
+void
+revdir_save(const revdir *revdir)
+{
+    unsigned short i;
+    serial_t ref;
+
+    checkpoint_put(&revdir->ndirs, sizeof(revdir->ndirs));
+    for (i = 0; i < revdir->ndirs; i++) {
+	ref = checkpoint_pack_index((char *)revdir->dirs[i]
+				    - offsetof(file_list_hash, fl));
+	checkpoint_put(&ref, sizeof(ref));
+    }
+}
+
+void
+revdir_load_packs(cvs_commit *(*file_at)(serial_t))
+{
+    serial_t n, j, k, ref, nfiles;
+    hash_t hash;
+    file_list_hash *h;
+
+    checkpoint_get(&n, sizeof(n));
+    checkpoint_packs = xmalloc(n * sizeof(void *), __func__);
+    checkpoint_npacks = n;
+    for (j = 0; j < n; j++) {
+	checkpoint_get(&hash, sizeof(hash));
+	checkpoint_get(&nfiles, sizeof(nfiles));
+	h = xmalloc(sizeof(file_list_hash) + nfiles * sizeof(commit_handle),
+		    __func__);
+	h->hash = hash;
+	h->fl.nfiles = nfiles;
+	for (k = 0; k < nfiles; k++) {
+	    checkpoint_get(&ref, sizeof(ref));
+	    h->fl.files[k] = cvs_commit_handle(file_at(ref));
+	}
+	h->next = buckets[hash % REV_DIR_HASH];
+	buckets[hash % REV_DIR_HASH] = h;
+	checkpoint_packs[j] = h;
+    }
+}
+
+void
+revdir_load(revdir *revdir)
+{
+    unsigned short i;
+    serial_t ref;
+
+    checkpoint_get(&revdir->ndirs, sizeof(revdir->ndirs));
+    revdir->dirs = xmalloc(revdir->ndirs * sizeof(file_list *), __func__);
+    for (i = 0; i < revdir->ndirs; i++) {
+	checkpoint_get(&ref, sizeof(ref));
+	if (ref >= checkpoint_npacks)
+	    fatal_error("checkpoint pack reference out of range");
+	revdir->dirs[i] = &((file_list_hash *)checkpoint_packs[ref])->fl;
+    }
+}
+
 void
 revdir_free_bufs(void)
 {
@@ -104,8 +190,8 @@ revdir_free_bufs(void)
 struct _revdir_iter {
     file_list * const *dir;
     file_list * const *dirmax;
-    cvs_commit **file;
-    cvs_commit **filemax;
+    commit_handle *file;
+    commit_handle *filemax;
 } file_iter;
 
 /* Iterator interface */
@@ -115,7 +201,7 @@ revdir_iter_next(revdir_iter *it) {
         return NULL;
 again:
     if (it->file != it->filemax)
-	return *it->file++;
+	return cvs_commit_at(*it->file++);
     ++it->dir;
     if (it->dir == it->dirmax)
         return NULL;
@@ -133,7 +219,7 @@ revdir_iter_next_dir(revdir_iter *it) {
     it->file = (*it->dir)->files;
     it->filemax = it->file + (*it->dir)->nfiles;
     if (it->file != it->filemax)
-	return *it->file++;
+	return cvs_commit_at(*it->file++);
     goto again;
 }
 
@@ -174,7 +260,7 @@ revdir_nfiles(const revdir *revdir)
 
 static serial_t         nfiles = 0;
 static serial_t         sfiles = 0;
-static const cvs_commit **files = NULL;
+static commit_handle	*files = NULL;
 static const master_dir *dir;
 static const master_dir *curdir;
 static unsigned short   ndirs;
@@ -183,10 +269,10 @@ void
 revdir_pack_alloc(const size_t max_size)
 {
     if (!files) {
-	files = xmalloc(max_size * sizeof(cvs_commit *), __func__);
+	files = xmalloc(max_size * sizeof(commit_handle), __func__);
 	sfiles = max_size;
     } else if (sfiles < max_size) {
-	files = xrealloc(files, max_size * sizeof(cvs_commit *), __func__);
+	files = xrealloc(files, max_size * sizeof(commit_handle), __func__);
 	sfiles = max_size;
     }
 }
@@ -201,7 +287,7 @@ revdir_pack_init(void)
 }
 
 void
-revdir_pack_add(const cvs_commit *file, const master_dir *in_dir)
+revdir_pack_add(const commit_handle file, const master_dir *in_dir)
 {
     if (curdir != in_dir) {
 	if (!dir_is_ancestor(in_dir, dir)) {
@@ -242,14 +328,11 @@ void
 revdir_pack_files(const cvs_commit ** files, 
 		  const size_t nfiles, revdir *revdir)
 {
-    size_t           start = 0, i;
-    const master_dir *curdir = NULL, *dir = NULL;
-    file_list        *fl;
-    unsigned short   ndirs = 0;
+    size_t           i;
 #ifdef ORDERDEBUG
     fputs("Packing:\n", stderr);
     {
-	cvs_commit **s;
+	const cvs_commit **s;
 	for (s = files; s < files + nfiles; s++)
 	    fprintf(stderr, "cvs_commit: %s\n", (*s)->master->name);
     }
@@ -264,28 +347,14 @@ revdir_pack_files(const cvs_commit ** files,
      * That used to be done with a qsort(3) call here, but sorting the
      * masters at the input stage causes them to come out in the right
      * order here, without multiple additional sorts.
+     *
+     * The lists hold commit handles, so go through the streaming
+     * interface, which gathers them.
      */
-    /* pull out directories */
-    for (i = 0; i < nfiles; i++) {
-	/* avoid strncmp as much as possible */
-	if (curdir != files[i]->dir) {
-	    if (!dir_is_ancestor(files[i]->dir, dir)) {
-		if (i > start) {
-		    fl = pack_file_list(files + start, i - start);
-		    fl_put(ndirs++, fl);
-		    start = i;
-		}
-		dir = files[i]->dir;
-	    }
-	    curdir = files[i]->dir;
-	}
-    }
-    if (dir) {
-        fl = pack_file_list(files + start, nfiles - start);
-        fl_put(ndirs++, fl);
-    }
-    
-    revdir->dirs = xmalloc(ndirs * sizeof(file_list *), "rev_dir");
-    revdir->ndirs = ndirs;
-    memcpy(revdir->dirs, dirs, ndirs * sizeof(file_list *));
+    revdir_pack_alloc(nfiles);
+    revdir_pack_init();
+    for (i = 0; i < nfiles; i++)
+	revdir_pack_add(cvs_commit_handle(files[i]), files[i]->dir);
+    revdir_pack_end(revdir);
+    revdir_pack_free();
 }
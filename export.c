@@ -17,13 +17,21 @@
  */
 #define _XOPEN_SOURCE 700
 #define _BSD_SOURCE
+#ifdef USE_VMSPLICE
+#define _GNU_SOURCE	/* for vmsplice() */
+#endif /* USE_VMSPLICE */
 
 #include <limits.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <ftw.h>
 #include <time.h>
+#include <fcntl.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
 
 #include "cvs.h"
 #include "revdir.h"
@@ -141,12 +149,91 @@ static char *blobfile(const char *basename,
     return path;
 }
 
-static void export_blob(node_t *node, 
-			void *buf, const size_t len,
-			export_options_t *opts)
-/* output the blob, or save where it will be available for random access */
+/*
+ * Blobs reach the output through blob sinks, so generate_stream() can
+ * hand over a snapshot a piece at a time instead of building it in
+ * one buffer first; a big binary goes out without ever being whole in
+ * core.  The blob being written is in blob_out, stdout or its file.
+ *
+ * Blobs of BLOB_DIRECT_MIN bytes or more bypass stdio: their pieces
+ * are gathered into an iovec pointing at the master text and written
+ * with writev(), so the bulk of the content is copied once, by the
+ * kernel, rather than into the stdio buffer first.  With USE_VMSPLICE,
+ * when stdout is a pipe and the pieces lie in a master's text map,
+ * they are spliced into the pipe and not copied at all; the header,
+ * which lives in a buffer reused for every blob, is still written.
+ */
+#define BLOB_DIRECT_MIN	(64 * 1024)
+
+static FILE *blob_out;
+static bool blob_direct;		/* bypassing stdio */
+static bool blob_splice;		/* and splicing the content */
+static char blob_header[64];
+static struct iovec *blob_iov;
+static int blob_niov, blob_maxiov;
+
+static void blob_writev(struct iovec *iov, int n, bool splice)
+/* write out an iovec whole, splicing its pages into a pipe if asked */
+{
+    int fd = fileno(blob_out);
+
+    while (n > 0) {
+	ssize_t done;
+
+#ifdef USE_VMSPLICE
+	if (splice)
+	    done = vmsplice(fd, iov, n, 0);
+	else
+#endif /* USE_VMSPLICE */
+	    done = writev(fd, iov, n);
+	if (done < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fatal_system_error("writing blob");
+	}
+	for (; n > 0 && (size_t)done >= iov->iov_len; iov++, n--)
+	    done -= iov->iov_len;
+	if (n > 0) {
+	    iov->iov_base = (char *)iov->iov_base + done;
+	    iov->iov_len -= done;
+	}
+    }
+}
+
+static void blob_iov_add(const void *buf, size_t len)
+/* queue a piece of a direct blob, writing the queue out when it is full */
+{
+    if (blob_maxiov == 0) {
+	blob_maxiov = IOV_MAX < 1024 ? IOV_MAX : 1024;
+	blob_iov = xmalloc(blob_maxiov * sizeof(struct iovec), "blob output");
+    }
+    if (blob_niov == blob_maxiov) {
+	blob_writev(blob_iov, blob_niov, blob_splice);
+	blob_niov = 0;
+    }
+    blob_iov[blob_niov].iov_base = (void *)buf;
+    blob_iov[blob_niov].iov_len = len;
+    blob_niov++;
+}
+
+#ifdef USE_VMSPLICE
+static bool stdout_is_pipe(void)
+{
+    static int is_pipe = -1;
+    struct stat st;
+
+    if (is_pipe == -1)
+	is_pipe = fstat(fileno(stdout), &st) == 0 && S_ISFIFO(st.st_mode);
+    return is_pipe;
+}
+#endif /* USE_VMSPLICE */
+
+static void export_blob_begin(node_t *node, size_t len, bool mapped,
+			      export_options_t *opts)
+/* start a blob: output it, or save it where it will be available for random access */
 {
     size_t extralen = 0;
+    int hlen = 0;
 
     export_stats.snapsize += len;
 
@@ -155,35 +242,165 @@ static void export_blob(node_t *node,
     }
 
     node->commit->serial = seqno_next();
-    if (opts->reportmode == fast) {
+    if (opts->reportmode != canonical) {
 	markmap[node->commit->serial] = ++mark;
-	printf("blob\nmark :%d\n", mark);
-	fprintf(stdout, "data %zd\n", len + extralen);
-	if (extralen > 0)
-	    fwrite(CVS_IGNORES, extralen, sizeof(char), stdout);
-	fwrite(buf, len, sizeof(char), stdout);
-	fputc('\n', stdout);
+	hlen = snprintf(blob_header, sizeof(blob_header), "blob\nmark :%d\n", mark);
+	blob_out = stdout;
     }
     else
     {
-	FILE *wfp;
-
 	char path[PATH_MAX];
 	blobfile(node->commit->master->name, node->commit->serial, true, path);
-	wfp = fopen(path, "w");
+	blob_out = fopen(path, "w");
 
-	if (wfp == NULL)
+	if (blob_out == NULL)
 	    fatal_error("blobfile open of %s: %s (%d)", 
 			path, strerror(errno), errno);
-	fprintf(wfp, "data %zd\n", len + extralen);
+    }
+    hlen += snprintf(blob_header + hlen, sizeof(blob_header) - hlen,
+		     "data %zd\n", len + extralen);
+
+    blob_direct = len >= BLOB_DIRECT_MIN;
+    if (!blob_direct) {
+	fwrite(blob_header, hlen, sizeof(char), blob_out);
 	if (extralen > 0)
-	    fwrite(CVS_IGNORES, extralen, sizeof(char), wfp);
-	fwrite(buf, len, sizeof(char), wfp);
-	fputc('\n', wfp);
-	(void)fclose(wfp);
+	    fwrite(CVS_IGNORES, extralen, sizeof(char), blob_out);
+	return;
+    }
+    fflush(blob_out);
+    blob_splice = false;
+#ifdef USE_VMSPLICE
+    if (mapped && blob_out == stdout && stdout_is_pipe()) {
+	struct iovec header = {blob_header, hlen};
+
+	blob_writev(&header, 1, false);
+	blob_splice = true;
+	hlen = 0;
     }
+#endif /* USE_VMSPLICE */
+    if (hlen > 0)
+	blob_iov_add(blob_header, hlen);
+    if (extralen > 0)
+	blob_iov_add(CVS_IGNORES, extralen);
 }
 
+static void export_blob_write(const void *buf, size_t len, export_options_t *opts)
+{
+    if (blob_direct)
+	blob_iov_add(buf, len);
+    else
+	fwrite(buf, len, sizeof(char), blob_out);
+}
+
+static void export_blob_end(node_t *node, export_options_t *opts)
+{
+    if (blob_direct) {
+	blob_iov_add("\n", 1);
+	blob_writev(blob_iov, blob_niov, blob_splice);
+	blob_niov = 0;
+    } else
+	fputc('\n', blob_out);
+    if (blob_out != stdout)
+	(void)fclose(blob_out);
+    blob_out = NULL;
+}
+
+static const blob_sink export_blob = {
+    export_blob_begin, export_blob_write, export_blob_end,
+};
+
+/*
+ * Canonical order with a blob budget (-b) stages no blobs on disk.
+ * Before anything is written, a pass over the sorted history works out
+ * each commit's fileops and numbers every revision in the order
+ * commits first refer to it, so a blob's serial is its place in the
+ * output.  Masters are then generated on demand, through the
+ * buffer_blob sink, into a reorder buffer indexed by serial.  A blob
+ * wanted by the commit being written is always kept; others are kept
+ * while they fit in the budget, dropping the ones needed furthest in
+ * the future to make room.  A blob dropped or never kept costs a
+ * second generation of its master later.
+ */
+typedef struct _blob_slot {
+    char	*text;		/* "data" header and content, once generated */
+    size_t	len;
+    bool	wanted;		/* by the commit being written */
+} blob_slot;
+
+static blob_slot *blob_slots;		/* by serial */
+static serial_t blob_frontier;		/* highest serial a commit has needed */
+static serial_t blob_high;		/* no slot above this holds text */
+static size_t blob_held;
+static serial_t *blob_pending;		/* unwritten blobs, by master */
+static int *blob_generated;		/* last commit each master was made for */
+static forest_t *blob_forest;
+
+static void blob_drop(blob_slot *b)
+{
+    blob_held -= b->len;
+    free(b->text);
+    b->text = NULL;
+}
+
+static char *blob_fill;			/* where buffer_blob_write() goes */
+
+static void buffer_blob_begin(node_t *node, size_t len, bool mapped,
+			      export_options_t *opts)
+/* make room in the reorder buffer for a blob if it may be needed soon */
+{
+    serial_t s = node->commit->serial;
+    size_t extralen = 0, size;
+    blob_slot *b;
+
+    blob_fill = NULL;
+    if (s == 0 || node->commit->emitted)
+	return;
+    b = &blob_slots[s];
+    if (b->text != NULL || (!b->wanted && s <= blob_frontier))
+	return;
+
+    if (strcmp(node->commit->master->name, ".cvsignore") == 0)
+	extralen = sizeof(CVS_IGNORES) - 1;
+    size = snprintf(NULL, 0, "data %zd\n", len + extralen) + len + extralen + 1;
+    if (!b->wanted) {
+	while (blob_held + size > opts->blob_budget && blob_high > s) {
+	    if (blob_slots[blob_high].text != NULL)
+		blob_drop(&blob_slots[blob_high]);
+	    blob_high--;
+	}
+	if (blob_held + size > opts->blob_budget)
+	    return;
+    }
+
+    blob_fill = b->text = xmalloc(size, "blob buffer");
+    blob_fill += sprintf(blob_fill, "data %zd\n", len + extralen);
+    memcpy(blob_fill, CVS_IGNORES, extralen);
+    blob_fill += extralen;
+    b->len = size;
+    blob_held += size;
+    if (s > blob_high)
+	blob_high = s;
+}
+
+static void buffer_blob_write(const void *buf, size_t len, export_options_t *opts)
+{
+    if (blob_fill != NULL) {
+	memcpy(blob_fill, buf, len);
+	blob_fill += len;
+    }
+}
+
+static void buffer_blob_end(node_t *node, export_options_t *opts)
+{
+    if (blob_fill != NULL)
+	*blob_fill = '\n';
+    blob_fill = NULL;
+}
+
+static const blob_sink buffer_blob = {
+    buffer_blob_begin, buffer_blob_write, buffer_blob_end,
+};
+
 static int unlink_cb(const char *fpath, 
 		     const struct stat *sb, int typeflag, struct FTW *ftwbuf)
 {
@@ -197,7 +414,7 @@ static int unlink_cb(const char *fpath,
 
 static void cleanup(const export_options_t *opts)
 {
-    if (opts->reportmode == canonical)
+    if (opts->reportmode == canonical && opts->blob_budget == 0)
         nftw(blobdir, unlink_cb, 64, FTW_DEPTH | FTW_PHYS);
 }
 
@@ -240,6 +457,13 @@ struct fileop {
     const char *path;
 };
 
+struct fileop_list {
+    /* the fileops of one commit, computed ahead of its emission */
+    struct fileop *operations;
+    int noperations;
+    char *revpairs;
+};
+
 /*
  * The magic number 100000 avoids generating forced UTC times that might be
  * negative in some timezone, while producing a sequence easy to read.
@@ -267,6 +491,52 @@ static void dump_commit(const git_commit *commit, FILE *fp)
 #endif /* ORDERDEBUG */
 
 
+static void blobs_fetch(const struct fileop_list *ops, const int k,
+			export_options_t *opts)
+/* make sure the blobs the k-th commit is about to write are in the buffer */
+{
+    forest_t *forest = blob_forest;
+    struct fileop *op;
+
+    for (op = ops->operations; op < ops->operations + ops->noperations; op++)
+	if (op->op == 'M' && !op->rev->emitted)
+	    blob_slots[op->rev->serial].wanted = true;
+    for (op = ops->operations; op < ops->operations + ops->noperations; op++)
+	if (op->op == 'M' && !op->rev->emitted
+	    && blob_slots[op->rev->serial].text == NULL) {
+	    size_t i = op->rev->master - forest->masters;
+
+	    /* once per commit; an incremental dump may not produce it */
+	    if (blob_generated[i] == k + 1)
+		continue;
+	    blob_generated[i] = k + 1;
+	    generator_expand(forest->generators + i);
+	    generate_stream(forest->generators + i, opts, &buffer_blob);
+	}
+}
+
+static void blobs_done(const struct fileop *operations, const struct fileop *end)
+/* after a commit, release what it wrote and anything it left behind */
+{
+    forest_t *forest = blob_forest;
+    const struct fileop *op;
+
+    for (op = operations; op < end; op++)
+	if (op->op == 'M' && blob_slots[op->rev->serial].wanted) {
+	    size_t i = op->rev->master - forest->masters;
+	    blob_slot *b = &blob_slots[op->rev->serial];
+
+	    b->wanted = false;
+	    if (b->text != NULL)
+		blob_drop(b);
+	    if (op->rev->serial > blob_frontier)
+		blob_frontier = op->rev->serial;
+	    /* a master whose blobs are all written is needed no more */
+	    if (op->rev->emitted && --blob_pending[i] == 0)
+		generator_free(forest->generators + i);
+	}
+}
+
 static struct fileop *
 next_op_slot(struct fileop **operations, struct fileop *op, int *noperations)
 /* move to next operations slot, expand if necessary */
@@ -323,26 +593,19 @@ build_delete_op(cvs_commit *c, struct fileop *op)
     op->op = 'D';
     op->path = c->master->fileop_name;
 }
+
 static void
-export_commit(git_commit *commit, const char *branch,
-	      const bool report, const export_options_t *opts)
-/* export a commit and the blobs it is the first to reference */
+compute_fileops(const git_commit *commit, const export_options_t *opts,
+		revdir_iter **citer, revdir_iter **piter,
+		struct fileop_list *ops)
+/* compute a commit's file operations against its parent; reads the DAG only */
 {
     const git_commit *parent = commit->parent;
     cvs_commit *cc;
-    cvs_author *author;
-    const char *full;
-    const char *email;
-    const char *timezone;
     char *revpairs = NULL;
     size_t revpairsize = 0;
-    time_t ct;
-    struct fileop *operations, *op, *op2;
+    struct fileop *operations, *op;
     int noperations;
-    serial_t here;
-    static const char *s_gitignore;
-
-    if (!s_gitignore) s_gitignore = atom(".gitignore");
 
     if (opts->reposurgeon || opts->revision_map || opts->embed_ids) {
 	revpairs = xmalloc((revpairsize = 1024), "revpair allocation");
@@ -358,18 +621,18 @@ export_commit(git_commit *commit, const char *branch,
      * The merge join also preseves this order, removing the need to sort
      * operations once generated.
      */
-    REVDIR_ITER_START(commit_iter, &commit->revdir);
+    REVDIR_ITER_START(*citer, &commit->revdir);
 
-    cc = revdir_iter_next(commit_iter);
+    cc = revdir_iter_next(*citer);
     if (parent) {
-	REVDIR_ITER_START(parent_iter, &parent->revdir);
+	REVDIR_ITER_START(*piter, &parent->revdir);
 
-	cvs_commit *pc = revdir_iter_next(parent_iter);
+	cvs_commit *pc = revdir_iter_next(*piter);
 	while (cc && pc) {
 	    /* If we're in the same packed directory then skip it */
-	    if (revdir_iter_same_dir(commit_iter, parent_iter)) {
-		pc = revdir_iter_next_dir(parent_iter);
-		cc = revdir_iter_next_dir(commit_iter);
+	    if (revdir_iter_same_dir(*citer, *piter)) {
+		pc = revdir_iter_next_dir(*piter);
+		cc = revdir_iter_next_dir(*citer);
 		continue;
 	    }
 	    if (cc == pc) {
@@ -377,8 +640,8 @@ export_commit(git_commit *commit, const char *branch,
 		 * as we have already accessed cc and pc, so they'll be hot
                  * plus, it's a common case.
 		 */
-		pc = revdir_iter_next(parent_iter);
-		cc = revdir_iter_next(commit_iter);
+		pc = revdir_iter_next(*piter);
+		cc = revdir_iter_next(*citer);
 		continue;
 	    }
 	    if (pc->master == cc->master) {
@@ -386,8 +649,8 @@ export_commit(git_commit *commit, const char *branch,
 		build_modify_op(cc, op);
 		append_revpair(cc, opts, &revpairs, &revpairsize);
 		op = next_op_slot(&operations, op, &noperations);
-		pc = revdir_iter_next(parent_iter);
-		cc = revdir_iter_next(commit_iter);
+		pc = revdir_iter_next(*piter);
+		cc = revdir_iter_next(*citer);
 		continue;
 	    }
 	    /* masters are sorted in fileop order */
@@ -395,33 +658,67 @@ export_commit(git_commit *commit, const char *branch,
 		/* parent but no child, delete op */
 		build_delete_op(pc, op);
 		op = next_op_slot(&operations, op, &noperations);
-		pc = revdir_iter_next(parent_iter);
+		pc = revdir_iter_next(*piter);
 	    } else {
 		/* child but no parent, modify op */
 		build_modify_op(cc, op);
 		append_revpair(cc, opts, &revpairs, &revpairsize);
 		op = next_op_slot(&operations, op, &noperations);
-		cc = revdir_iter_next(commit_iter);
+		cc = revdir_iter_next(*citer);
 	    }
 	}
-	for (; pc; pc = revdir_iter_next(parent_iter)) {
+	for (; pc; pc = revdir_iter_next(*piter)) {
 	    /* parent but no child, delete op */
 	    build_delete_op(pc, op);
 	    op = next_op_slot(&operations, op, &noperations);
 	}
     }
-    for (; cc; cc = revdir_iter_next(commit_iter)) {
+    for (; cc; cc = revdir_iter_next(*citer)) {
 	/* child but no parent, modify op */
 	build_modify_op(cc, op);
 	append_revpair(cc, opts, &revpairs, &revpairsize);
 	op = next_op_slot(&operations, op, &noperations);
     }
 
+    ops->operations = operations;
+    ops->noperations = op - operations;
+    ops->revpairs = revpairs;
+#undef OP_CHUNK
+}
+
+static void
+export_commit(git_commit *commit, const char *branch,
+	      const bool report, const export_options_t *opts,
+	      struct fileop_list *ops)
+/* export a commit and the blobs it is the first to reference */
+{
+    cvs_author *author;
+    const char *full;
+    const char *email;
+    const char *timezone;
+    char *revpairs = ops->revpairs;
+    time_t ct;
+    struct fileop *operations = ops->operations;
+    struct fileop *op = operations + ops->noperations, *op2;
+    serial_t here;
+    static const char *s_gitignore;
+
+    if (!s_gitignore) s_gitignore = atom(".gitignore");
+
     for (op2 = operations; op2 < op; op2++) {
 	if (op2->op == 'M' && !op2->rev->emitted) {
 	    if (opts->reportmode == canonical)
 		markmap[op2->rev->serial] = ++mark;
-	    if (report && opts->reportmode == canonical) {
+	    if (report && blob_slots != NULL) {
+		blob_slot *b = &blob_slots[op2->rev->serial];
+		if (b->text != NULL) {
+		    printf("blob\nmark :%d\n", mark);
+		    fwrite(b->text, 1, b->len, stdout);
+		    export_stats.snapsize += b->len;
+		    blob_drop(b);
+		    op2->rev->emitted = true;
+		}
+	    } else if (report && opts->reportmode == canonical) {
 		char path[PATH_MAX];
 		char *fn = blobfile(op2->path, op2->rev->serial, false, path);
 		FILE *rfp = fopen(fn, "r");
@@ -496,7 +793,7 @@ export_commit(git_commit *commit, const char *branch,
 		printf("D %s\n", op2->path);
 	    /*
 	     * If there's a .gitignore in the first commit, don't generate one.
-	     * export_blob() will already have prepended them.
+	     * export_blob_begin() will already have prepended them.
 	     */
 	    if (need_ignores && op2->path == s_gitignore)
 		need_ignores = false;
@@ -523,12 +820,130 @@ export_commit(git_commit *commit, const char *branch,
 	    }
 	}
     }
+    if (blob_slots != NULL)
+	blobs_done(operations, op);
     free(revpairs);
     free(operations);
 
     if (report)
 	printf("\n");
-#undef OP_CHUNK
+}
+
+/*
+ * With --shard-dir the fast-order stream is split across files so
+ * several importers can work on it at once.  Shard 0 gets every blob,
+ * trunk, and any other branch with no parent; each branch rooted in
+ * shard 0 starts a subtree that goes whole to whichever of the other
+ * shards has the fewest commits so far.  Marks stay global, so the
+ * only marks a shard refers to and does not define are shard 0's,
+ * which its importer gets from the marks file the first import wrote.
+ * Those marks name objects, not just numbers, so the shards must all
+ * go into one object store (or ones joined by alternates).
+ * Standard output is pointed at one shard after another, so none of
+ * the writers need to know about shards.
+ */
+static int *shard_fds, nshards, shard_now;
+static int saved_stdout;
+static long *shard_load;		/* commits in each shard */
+static int *commit_shard;		/* by serial */
+
+static void shard_select(const int k)
+/* send standard output to shard k */
+{
+    if (k == shard_now)
+	return;
+    fflush(stdout);
+    if (dup2(shard_fds[k], STDOUT_FILENO) < 0)
+	fatal_system_error("switching to shard %d", k);
+    shard_now = k;
+}
+
+static void shards_open(const export_options_t *opts, const size_t nmarks)
+/* create the shard files and start writing to the first */
+{
+    char path[PATH_MAX];
+    int k;
+
+    if (mkdir(opts->shard_dir, 0777) != 0 && errno != EEXIST)
+	fatal_system_error("cannot make shard directory %s", opts->shard_dir);
+    nshards = opts->shards + 1;
+    shard_fds = xcalloc(nshards, sizeof(int), "shards");
+    for (k = 0; k < nshards; k++) {
+	snprintf(path, sizeof(path), "%s/%d.fi", opts->shard_dir, k);
+	shard_fds[k] = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (shard_fds[k] < 0)
+	    fatal_system_error("cannot open shard %s", path);
+    }
+    shard_load = xcalloc(nshards, sizeof(long), "shards");
+    commit_shard = xcalloc(nmarks, sizeof(int), "shards");
+
+    fflush(stdout);
+    if ((saved_stdout = dup(STDOUT_FILENO)) < 0)
+	fatal_system_error("cannot save standard output");
+    shard_now = -1;
+    shard_select(0);
+}
+
+static int shard_of_branch(const git_commit *root, const int ncommits)
+/* a branch goes with its parent, unless it leaves shard 0 */
+{
+    int k = 0, i;
+
+    if (root->parent != NULL && (k = commit_shard[root->parent->serial]) == 0) {
+	k = 1;
+	for (i = 2; i < nshards; i++)
+	    if (shard_load[i] < shard_load[k])
+		k = i;
+    }
+    shard_load[k] += ncommits;
+    return k;
+}
+
+static void shards_close(void)
+/* end every shard and put standard output back */
+{
+    int k;
+
+    for (k = 0; k < nshards; k++) {
+	shard_select(k);
+	fputs("done\n", stdout);
+    }
+    fflush(stdout);
+    if (dup2(saved_stdout, STDOUT_FILENO) < 0)
+	fatal_system_error("cannot restore standard output");
+    close(saved_stdout);
+    for (k = 0; k < nshards; k++)
+	if (close(shard_fds[k]) != 0)
+	    fatal_system_error("writing shard %d", k);
+    free(shard_fds);
+    free(shard_load);
+    free(commit_shard);
+    commit_shard = NULL;
+}
+
+static void generate_master(generator_t *gp, export_options_t *opts)
+/* emit or stash the blobs of one master, then release its generator */
+{
+    generator_expand(gp);
+    generate_stream(gp, opts, &export_blob);
+    generator_free(gp);
+}
+
+static void generate_needed(forest_t *forest, const struct fileop_list *ops,
+			    bool *generated, export_options_t *opts)
+/* in streaming order, emit the blobs of masters a commit is first to need */
+{
+    struct fileop *op;
+
+    for (op = ops->operations; op < ops->operations + ops->noperations; op++)
+	if (op->op == 'M') {
+	    size_t i = op->rev->master - forest->masters;
+
+	    if (!generated[i]) {
+		generated[i] = true;
+		generate_master(forest->generators + i, opts);
+	    }
+	}
 }
 
 static int export_ncommit(const git_repo *rl)
@@ -557,6 +972,159 @@ struct commit_seq {
     bool realized;
 };
 
+/*
+ * In canonical mode commits are emitted from one big history array.
+ * Computing each commit's fileops means walking two revdirs, which only
+ * reads the DAG, so with threads available a few workers run ahead of
+ * the writer filling a window of slots and the writer just picks up
+ * each commit's list in order, formats it and moves on.
+ */
+#define FILEOP_WINDOW	256	/* commits computed ahead of the writer */
+#define FILEOP_WORKERS	8	/* beyond this the writer is the bottleneck */
+
+static struct {
+    const struct commit_seq *history;
+    int ncommits;
+    const export_options_t *opts;
+    int nworkers;
+#ifdef THREADS
+    pthread_t workers[FILEOP_WORKERS];
+    struct fileop_list slots[FILEOP_WINDOW];
+    bool ready[FILEOP_WINDOW];
+    int claimed;		/* commits handed to workers so far */
+    int consumed;		/* commits taken by the writer so far */
+    pthread_mutex_t mutex;
+    pthread_cond_t produced;
+    pthread_cond_t freed;
+#endif /* THREADS */
+} fileops;
+
+#ifdef THREADS
+static void *
+fileops_worker(void *arg)
+/* precompute fileop lists for commits the writer will reach soon */
+{
+    revdir_iter *citer = NULL, *piter = NULL;
+    struct fileop_list ops;
+    int i;
+
+    for (;;) {
+	pthread_mutex_lock(&fileops.mutex);
+	while (fileops.claimed < fileops.ncommits
+	       && fileops.claimed >= fileops.consumed + FILEOP_WINDOW)
+	    pthread_cond_wait(&fileops.freed, &fileops.mutex);
+	i = fileops.claimed++;
+	pthread_mutex_unlock(&fileops.mutex);
+	if (i >= fileops.ncommits)
+	    break;
+
+	compute_fileops(fileops.history[i].commit, fileops.opts,
+			&citer, &piter, &ops);
+
+	pthread_mutex_lock(&fileops.mutex);
+	fileops.slots[i % FILEOP_WINDOW] = ops;
+	fileops.ready[i % FILEOP_WINDOW] = true;
+	pthread_cond_broadcast(&fileops.produced);
+	pthread_mutex_unlock(&fileops.mutex);
+    }
+    free(citer);
+    free(piter);
+    return NULL;
+}
+#endif /* THREADS */
+
+static void
+fileops_begin(const struct commit_seq *history, const int ncommits,
+	      const export_options_t *opts)
+/* start computing fileops for a history array */
+{
+    fileops.history = history;
+    fileops.ncommits = ncommits;
+    fileops.opts = opts;
+    fileops.nworkers = 0;
+#ifdef THREADS
+    if (threads > 1 && ncommits > 1) {
+	int i;
+
+	fileops.nworkers = threads < FILEOP_WORKERS ? threads : FILEOP_WORKERS;
+	fileops.claimed = fileops.consumed = 0;
+	memset(fileops.ready, '\0', sizeof(fileops.ready));
+	pthread_mutex_init(&fileops.mutex, NULL);
+	pthread_cond_init(&fileops.produced, NULL);
+	pthread_cond_init(&fileops.freed, NULL);
+	for (i = 0; i < fileops.nworkers; i++)
+	    pthread_create(&fileops.workers[i], NULL, fileops_worker, NULL);
+    }
+#endif /* THREADS */
+}
+
+static void
+fileops_take(const int i, struct fileop_list *ops)
+/* get the fileops of the i-th commit; must be called in order */
+{
+#ifdef THREADS
+    if (fileops.nworkers > 0) {
+	pthread_mutex_lock(&fileops.mutex);
+	while (!fileops.ready[i % FILEOP_WINDOW])
+	    pthread_cond_wait(&fileops.produced, &fileops.mutex);
+	*ops = fileops.slots[i % FILEOP_WINDOW];
+	fileops.ready[i % FILEOP_WINDOW] = false;
+	fileops.consumed = i + 1;
+	pthread_cond_broadcast(&fileops.freed);
+	pthread_mutex_unlock(&fileops.mutex);
+	return;
+    }
+#endif /* THREADS */
+    compute_fileops(fileops.history[i].commit, fileops.opts,
+		    &commit_iter, &parent_iter, ops);
+}
+
+static void
+fileops_end(void)
+/* wait for the workers, which have nothing left to do */
+{
+#ifdef THREADS
+    int i;
+
+    for (i = 0; i < fileops.nworkers; i++)
+	pthread_join(fileops.workers[i], NULL);
+    if (fileops.nworkers > 0) {
+	pthread_mutex_destroy(&fileops.mutex);
+	pthread_cond_destroy(&fileops.produced);
+	pthread_cond_destroy(&fileops.freed);
+    }
+#endif /* THREADS */
+    fileops.nworkers = 0;
+}
+
+static void blobs_plan(forest_t *forest, const struct commit_seq *history,
+		       const int ncommits, const export_options_t *opts)
+/* number revisions in the order the history first needs their blobs */
+{
+    struct fileop_list ops;
+    struct fileop *op;
+    int i;
+
+    blob_forest = forest;
+    blob_pending = xcalloc(forest->filecount, sizeof(serial_t), "blob buffer");
+    blob_generated = xcalloc(forest->filecount, sizeof(int), "blob buffer");
+    fileops_begin(history, ncommits, opts);
+    for (i = 0; i < ncommits; i++) {
+	fileops_take(i, &ops);
+	for (op = ops.operations; op < ops.operations + ops.noperations; op++)
+	    /* generate_stream() makes nothing at or before the cutoff */
+	    if (op->op == 'M' && op->rev->serial == 0
+		&& op->rev->date > opts->fromtime) {
+		op->rev->serial = seqno_next();
+		blob_pending[op->rev->master - forest->masters]++;
+	    }
+	free(ops.operations);
+	free(ops.revpairs);
+    }
+    fileops_end();
+    blob_slots = xcalloc(seqno + 1, sizeof(blob_slot), "blob buffer");
+}
+
 static int compare_commit(const git_commit *ac, const git_commit *bc)
 /* attempt the mathematically impossible total ordering on the DAG */
 {
@@ -612,6 +1180,109 @@ static int sort_by_date(const void *ap, const void *bp)
     }
 }
 
+/*
+ * Sorting the canonical history with qsort(3) and sort_by_date() made
+ * every comparison chase commit pointers, and the ties strcmp() authors
+ * and logs.  But sort_by_date() decides on the date alone unless the
+ * dates are equal, so a stable sort on a precomputed date key, followed
+ * by a stable sort of each run of equal dates with sort_by_date()
+ * itself, gives the same order as a stable sort with sort_by_date()
+ * throughout.  The key sort is an LSD radix sort, linear in the number
+ * of commits; the runs are merge sorted and are seldom longer than a
+ * few commits.
+ */
+
+struct sort_key {
+    cvstime_t	date;
+    serial_t	index;		/* position before sorting */
+};
+
+static void radix_sort_keys(struct sort_key *keys, const size_t n)
+/* stable sort of keys by date, a byte at a time from the bottom */
+{
+    struct sort_key *tmp = xmalloc(n * sizeof(struct sort_key), __func__);
+    struct sort_key *from = keys, *to = tmp, *swap;
+    size_t count[256], i;
+    int shift;
+
+    for (shift = 0; shift < 32; shift += 8) {
+	size_t pos = 0;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+	    count[(from[i].date >> shift) & 0xff]++;
+	/* a byte every key shares leaves the order as it is */
+	if (count[(from[0].date >> shift) & 0xff] == n)
+	    continue;
+	for (i = 0; i < 256; i++) {
+	    size_t c = count[i];
+	    count[i] = pos;
+	    pos += c;
+	}
+	for (i = 0; i < n; i++)
+	    to[count[(from[i].date >> shift) & 0xff]++] = from[i];
+	swap = from; from = to; to = swap;
+    }
+    if (from != keys)
+	memcpy(keys, from, n * sizeof(struct sort_key));
+    free(tmp);
+}
+
+static void merge_sort_run(struct commit_seq *run, struct commit_seq *tmp, const size_t n)
+/* stable sort with sort_by_date(), splitting as glibc's qsort does */
+{
+    size_t n1 = n / 2, n2 = n - n1, i = 0, j = 0, k = 0;
+    struct commit_seq *b1 = run, *b2 = run + n1;
+
+    if (n <= 1)
+	return;
+    merge_sort_run(b1, tmp, n1);
+    merge_sort_run(b2, tmp, n2);
+    while (i < n1 && j < n2) {
+	if (sort_by_date(&b1[i], &b2[j]) <= 0)
+	    tmp[k++] = b1[i++];
+	else
+	    tmp[k++] = b2[j++];
+    }
+    while (i < n1)
+	tmp[k++] = b1[i++];
+    /* anything left in b2 is already in place */
+    memcpy(run, tmp, k * sizeof(struct commit_seq));
+}
+
+static void sort_history(struct commit_seq *history, const size_t n)
+/* put the history in commit-date order; see above */
+{
+    struct sort_key *keys;
+    struct commit_seq *sorted, *tmp;
+    size_t i, start;
+
+    if (n < 2)
+	return;
+    keys = xmalloc(n * sizeof(struct sort_key), __func__);
+    for (i = 0; i < n; i++) {
+	keys[i].date = history[i].commit->date;
+	keys[i].index = i;
+    }
+    radix_sort_keys(keys, n);
+
+    sorted = xmalloc(n * sizeof(struct commit_seq), __func__);
+    for (i = 0; i < n; i++)
+	sorted[i] = history[keys[i].index];
+    memcpy(history, sorted, n * sizeof(struct commit_seq));
+
+    /* sorted is free again, and big enough to merge any run in */
+    tmp = sorted;
+    for (start = 0; start < n; start = i) {
+	for (i = start + 1; i < n && keys[i].date == keys[start].date; i++)
+	    continue;
+	if (i - start > 1)
+	    merge_sort_run(history + start, tmp, i - start);
+    }
+    free(sorted);
+    free(keys);
+}
+
 static struct commit_seq *canonicalize(git_repo *rl)
 /* copy/sort merged commits into git-fast-export order */
 {
@@ -722,7 +1393,7 @@ void export_commits(forest_t *forest,
 	    opts->reportmode = fast;
     }
 
-    if (opts->reportmode == canonical)
+    if (opts->reportmode == canonical && opts->blob_budget == 0)
     {
 	char *tmp = getenv("TMPDIR");
 	if (tmp == NULL) 
@@ -742,36 +1413,56 @@ void export_commits(forest_t *forest,
 				  forest->total_revisions + export_stats.export_total_commits + 1,
 				  "markmap allocation");
 
-    /* export_blob() touches markmap when in fast mode */
-    progress_begin("Generating snapshots...", forest->filecount);
-    for (gp = forest->generators; 
-	 gp < forest->generators + forest->filecount;
-	 gp++) {
-	generate_files(gp, opts, export_blob);
-	generator_free(gp);
-	progress_jump(++recount);
+    if (opts->shard_dir != NULL)
+	shards_open(opts, forest->total_revisions + export_stats.export_total_commits + 1);
+
+    /*
+     * export_blob_begin() touches markmap when in fast mode.  In streaming
+     * order, and canonical order with a blob budget, the masters are
+     * generated as the commits come to need them.
+     */
+    if (opts->reportmode == fast
+	|| (opts->reportmode == canonical && opts->blob_budget == 0)) {
+	progress_begin("Generating snapshots...", forest->filecount);
+	for (gp = forest->generators; 
+	     gp < forest->generators + forest->filecount;
+	     gp++) {
+	    generate_master(gp, opts);
+	    progress_jump(++recount);
+	}
+	progress_end("done");
     }
-    progress_end("done");
 
     if (progress)
     {
 	static char msgbuf[100];
 	snprintf(msgbuf, sizeof(msgbuf), "Saving in %s order: ",
-		opts->reportmode == fast ? "fast" : "canonical");
+		opts->reportmode == fast ? "fast" :
+		opts->reportmode == streaming ? "streaming" : "canonical");
 	progress_begin(msgbuf, export_stats.export_total_commits);
     }
 
-    if (opts->reportmode == fast) {
+    if (opts->reportmode != canonical) {
 	/*
 	 * Dump by branch order, not by commit date.  Slightly faster
 	 * and less memory-intensive, but it's not git-fast-export
 	 * canonical form and cannot be directly compared to the
 	 * output of other tools.
+	 *
+	 * Streaming order is the same walk, but a master's blobs go
+	 * out just before the first commit that needs one of them,
+	 * so an importer can start on commits almost at once.
+	 * Masters no exported commit refers to are never generated.
 	 */
 	git_commit **history;
+	struct fileop_list ops;
+	bool *generated = NULL;
 	int alloc, i;
 	int n;
 
+	if (opts->reportmode == streaming)
+	    generated = xcalloc(forest->filecount, sizeof(bool), "export");
+
 	for (h = rl->heads; h; h = h->next) {
 	    if (!h->tail) {
 		// We need to export commits in reverse order; so
@@ -787,6 +1478,8 @@ void export_commits(forest_t *forest,
 		    }
 		    history[n] = c;
 		}
+		if (commit_shard != NULL)
+		    shard_select(shard_of_branch(history[n-1], n));
 
 		/*
 		 * Now walk the history array in reverse order and export the
@@ -799,7 +1492,12 @@ void export_commits(forest_t *forest,
 		    if (gc->parent != NULL && display_date(gc->parent, markmap[gc->parent->serial], opts->force_dates) < opts->fromtime)
 			(void)printf("from %s%s^0\n\n",
 				     opts->branch_prefix, h->ref_name);
-		    export_commit(gc, h->ref_name, true, opts);
+		    compute_fileops(gc, opts, &commit_iter, &parent_iter, &ops);
+		    if (generated)
+			generate_needed(forest, &ops, generated, opts);
+		    export_commit(gc, h->ref_name, true, opts, &ops);
+		    if (commit_shard != NULL)
+			commit_shard[gc->serial] = shard_now;
 		    progress_step();
 		    for (t = all_tags; t; t = t->next)
 			if (t->commit == gc && display_date(gc, markmap[gc->serial], opts->force_dates) > opts->fromtime)
@@ -809,6 +1507,12 @@ void export_commits(forest_t *forest,
 		free(history);
 	    }
 	}
+	if (generated) {
+	    for (i = 0; i < forest->filecount; i++)
+		if (!generated[i])
+		    generator_discard(forest->generators + i);
+	    free(generated);
+	}
     }
     else 
     {	
@@ -837,14 +1541,16 @@ void export_commits(forest_t *forest,
 	    }
 	}
 	if (sortable)
-	    qsort((void *)history, 
-		  export_stats.export_total_commits, sizeof(struct commit_seq),
-		  sort_by_date);
+	    sort_history(history, export_stats.export_total_commits);
+	if (opts->blob_budget > 0)
+	    blobs_plan(forest, history, export_stats.export_total_commits, opts);
 
 #ifdef ORDERDEBUG2
 	fputs("Export phase 3:\n", stderr);
 #endif /* ORDERDEBUG2 */
+	fileops_begin(history, export_stats.export_total_commits, opts);
 	for (hp = history; hp < history + export_stats.export_total_commits; hp++) {
+	    struct fileop_list ops;
 	    bool report = true;
 	    if (opts->fromtime > 0) {
 		if (opts->fromtime >= display_date(hp->commit, mark+1, opts->force_dates)) {
@@ -861,16 +1567,28 @@ void export_commits(forest_t *forest,
 		}
 	    }
 	    progress_jump(hp - history);
-	    export_commit(hp->commit, hp->head->ref_name, report, opts);
+	    fileops_take(hp - history, &ops);
+	    if (blob_slots != NULL)
+		blobs_fetch(&ops, hp - history, opts);
+	    export_commit(hp->commit, hp->head->ref_name, report, opts, &ops);
 	    for (t = all_tags; t; t = t->next)
 		if (t->commit == hp->commit && display_date(hp->commit, markmap[hp->commit->serial], opts->force_dates) > opts->fromtime)
 		    printf("reset refs/tags/%s\nfrom :%d\n\n", t->name, markmap[hp->commit->serial]);
 	}
+	fileops_end();
 
 	free(history);
+	if (blob_slots != NULL) {
+	    free(blob_slots);
+	    free(blob_pending);
+	    free(blob_generated);
+	    blob_slots = NULL;
+	}
     }
 
     for (h = rl->heads; h; h = h->next) {
+	if (commit_shard != NULL)
+	    shard_select(commit_shard[h->commit->serial]);
 	if (display_date(h->commit, markmap[h->commit->serial], opts->force_dates) > opts->fromtime)
 	    printf("reset %s%s\nfrom :%d\n\n",
 		   opts->branch_prefix,
@@ -878,10 +1596,14 @@ void export_commits(forest_t *forest,
 		   markmap[h->commit->serial]);
     }
     free(markmap);
+    free(blob_iov);
 
     progress_end("done");
 
-    fputs("done\n", stdout);
+    if (commit_shard != NULL)
+	shards_close();
+    else
+	fputs("done\n", stdout);
 
     cleanup(opts);
 
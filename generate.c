@@ -28,7 +28,7 @@
 /*
  * The entire aim of this module is the last function, which turns
  * the in-core revision history of a CVS/RCS master file and materializes
- * all of its revision levels through a specified export hook.
+ * all of its revision levels through a specified blob sink.
  */
 
 #include <limits.h>
@@ -907,102 +907,145 @@ static void expandedit(editbuffer_t *eb)
 #endif
 }
 /*
- * The FASTOUT code is a shameless micro-optimization addressing the
- * fact that without it this out_putc() loop consistently shows up as
- * a severe hotspot.  Flattening it shaves about 1.5% off wall time,
- * which can be significant for large repositories.
- *
- * The author, Laurence Hygate <loz@flower.powernet.co.uk>, says:
- * "snapshotline is mostly called on small text lines so the buffer is
- * unlikely to get enlarged more than once and data is unlikely to
- * drop off cachelines before the memcpy"
+ * Streamed snapshots.  Without keyword expansion a snapshot is just the
+ * edit buffer's lines with @@ unescaped, so its length can be added up
+ * before any of it is written, and the text can go to a blob sink in
+ * place.  Lines that sit next to each other in the master's text, as
+ * unedited runs do, are passed on as one chunk.
  */
-#define FASTOUT
-static void snapshotline(editbuffer_t *eb, register uchar * l)
+struct snapshot_chunk {
+    const blob_sink *sink;
+    export_options_t *opts;
+    const uchar *ptr;
+    size_t len;
+};
+
+static void chunk_add(struct snapshot_chunk *ch, const uchar *p, size_t len)
+/* queue text for the sink, passing on what can't be joined to it */
 {
-    register int c;
-#ifdef FASTOUT
-    struct out_buffer_type *ob = eb->Goutbuf;
-    uchar * start = l;
-#endif
+    if (ch->len > 0 && ch->ptr + ch->len == p) {
+	ch->len += len;
+	return;
+    }
+    if (ch->len > 0)
+	ch->sink->write(ch->ptr, ch->len, ch->opts);
+    ch->ptr = p;
+    ch->len = len;
+}
+
+static size_t snapshotline_length(const uchar *l)
+/* the length of a line with its @@ escapes undone */
+{
+    size_t n = 0;
+    int c;
+
     do {
-#ifndef FASTOUT
 	if ((c = *l++) == SDELIM  &&  *l++ != SDELIM)
-	    return;
-	out_putc(eb, c);
-#else
+	    break;
+	n++;
+    } while (c != '\n');
+    return n;
+}
+
+static void snapshotline_stream(struct snapshot_chunk *ch, const uchar *l)
+/* a line to a sink, @@ unescaped: the pieces between escapes go as they are */
+{
+    const uchar *start = l;
+    int c;
+
+    do {
 	if ((c = *l++) == SDELIM  &&  *l++ != SDELIM) {
 	    l = l - 2;
 	    break;
 	}
 	if (c == SDELIM) {
-	    // @@ is a memcpy barrier as we're unescaping it
-	    // -1 because if we get here we skipped a SDELIM
-	    while (ob->end_of_text - ob->ptr < l - start - 1) {
-	    	out_buffer_enlarge(eb);
-		ob = eb->Goutbuf;
-	    }
-	    memcpy(ob->ptr, start, l - start - 1);
-	    ob->ptr += l - start - 1;
+	    chunk_add(ch, start, l - start - 1);
 	    start = l;
 	}
-#endif
     } while (c != '\n');
-
-#ifdef FASTOUT
-    if (l - start != 0) {
-	while (ob->end_of_text - ob->ptr < l - start) {
-	    out_buffer_enlarge(eb);
-            ob = eb->Goutbuf;
-	}
-	memcpy(ob->ptr, start, l - start);
-	ob->ptr += l - start;
-    }
-#endif /* FASTOUT */
+    if (l - start != 0)
+	chunk_add(ch, start, l - start);
 }
 
 #ifdef LINESTATS
-static void snapshotline_nodelim(editbuffer_t *eb, editline_t *l)
+static size_t snapshot_length(editbuffer_t *eb)
 {
-    struct out_buffer_type *ob = eb->Goutbuf;
-    size_t chars_read = l->length;
-    if (chars_read != 0) {
-	while (ob->end_of_text - ob->ptr < chars_read) {
-	    out_buffer_enlarge(eb);
-	    ob = eb->Goutbuf;
-	}
-	memcpy(ob->ptr, l->ptr, chars_read);
-	ob->ptr += chars_read;
-    }
+    editline_t *p, *lim, *l = Gline(eb);
+    size_t len = 0;
+
+    for (p=l, lim=l+Ggap(eb);  p<lim;  p++)
+	len += p->has_stringdelim ? snapshotline_length(p->ptr) : p->length;
+    for (p+=Ggapsize(eb), lim=l+Glinemax(eb);  p<lim;  p++)
+	len += p->has_stringdelim ? snapshotline_length(p->ptr) : p->length;
+    return len;
 }
 
-static void snapshotedit(editbuffer_t *eb)
+static void snapshotstream(editbuffer_t *eb, struct snapshot_chunk *ch)
 {
     editline_t *p, *lim, *l = Gline(eb);
 
-    for (p=l, lim=l+Ggap(eb);  p<lim;  )
+    for (p=l, lim=l+Ggap(eb);  p<lim;  p++)
 	if (p->has_stringdelim)
-	    snapshotline(eb, (*p++).ptr);
+	    snapshotline_stream(ch, p->ptr);
 	else
-	    snapshotline_nodelim(eb, p++);
-
-    for (p+=Ggapsize(eb), lim=l+Glinemax(eb);  p<lim;  )
+	    chunk_add(ch, p->ptr, p->length);
+    for (p+=Ggapsize(eb), lim=l+Glinemax(eb);  p<lim;  p++)
 	if (p->has_stringdelim)
-	    snapshotline(eb, (*p++).ptr);
+	    snapshotline_stream(ch, p->ptr);
 	else
-	    snapshotline_nodelim(eb, p++);
+	    chunk_add(ch, p->ptr, p->length);
 }
 #else
-static void snapshotedit(editbuffer_t *eb)
+static size_t snapshot_length(editbuffer_t *eb)
+{
+    uchar **p, **lim, **l = Gline(eb);
+    size_t len = 0;
+
+    for (p=l, lim=l+Ggap(eb);  p<lim;  )
+	len += snapshotline_length(*p++);
+    for (p+=Ggapsize(eb), lim=l+Glinemax(eb);  p<lim;  )
+	len += snapshotline_length(*p++);
+    return len;
+}
+
+static void snapshotstream(editbuffer_t *eb, struct snapshot_chunk *ch)
 {
-    uchar **p, **lim, **l=Gline(eb);
+    uchar **p, **lim, **l = Gline(eb);
+
     for (p=l, lim=l+Ggap(eb);  p<lim;  )
-	snapshotline(eb, *p++);
+	snapshotline_stream(ch, *p++);
     for (p+=Ggapsize(eb), lim=l+Glinemax(eb);  p<lim;  )
-	snapshotline(eb, *p++);
+	snapshotline_stream(ch, *p++);
 }
 #endif
 
+static void snapshot_sink(editbuffer_t *eb, node_t *node,
+			  const blob_sink *sink, export_options_t *opts)
+/* pass one revision's snapshot to a sink */
+{
+    if (eb->Gexpand < EXPANDKO) {
+	/* expansion changes lengths as it goes; build the text first */
+	out_buffer_init(eb);
+	expandedit(eb);
+	sink->begin(node, out_buffer_count(eb), false, opts);
+	sink->write(out_buffer_text(eb), out_buffer_count(eb), opts);
+	sink->end(node, opts);
+	out_buffer_cleanup(eb);
+    } else {
+	struct snapshot_chunk ch = {sink, opts, NULL, 0};
+
+#ifdef USE_MMAP
+	sink->begin(node, snapshot_length(eb), true, opts);
+#else
+	sink->begin(node, snapshot_length(eb), false, opts);
+#endif /* USE_MMAP */
+	snapshotstream(eb, &ch);
+	if (ch.len > 0)
+	    sink->write(ch.ptr, ch.len, opts);
+	sink->end(node, opts);
+    }
+}
+
 static void enter_branch(editbuffer_t *eb, const node_t *const node)
 {
 #ifdef LINESTATS
@@ -1022,12 +1065,11 @@ static void enter_branch(editbuffer_t *eb, const node_t *const node)
 #endif
 }
 
-static node_t *generate_setup(generator_t *gen, enum expand_mode id_token_expand)
+static node_t *generate_setup(editbuffer_t *eb, generator_t *gen,
+			      enum expand_mode id_token_expand)
 {
     if (gen->nodehash.head_node != NULL)
     {
-	editbuffer_t *eb = &gen->editbuffer;
-
 	eb->Gkeyval = NULL;
 	eb->Gkvlen = 0;
 
@@ -1048,10 +1090,8 @@ static node_t *generate_setup(generator_t *gen, enum expand_mode id_token_expand
     return gen->nodehash.head_node;
 }
 
-static void generate_wrap(generator_t *gen)
+static void generate_wrap(editbuffer_t *eb)
 {
-    editbuffer_t *eb = &gen->editbuffer;
-
     free(eb->Gkeyval);
     eb->Gkeyval = NULL;
     eb->Gkvlen = 0;
@@ -1059,13 +1099,17 @@ static void generate_wrap(generator_t *gen)
     unload_all_text(eb);
 }
 
-void generate_files(generator_t *gen,
-		    export_options_t *opts,
-		    void(*hook)(node_t *node, void *buf, size_t len, export_options_t *opts))
-/* export all the revision states of a CVS/RCS master through a hook */
+void generate_stream(generator_t *gen, export_options_t *opts,
+		     const blob_sink *sink)
+/* export all the revision states of a master to a sink, a piece at a time */
 {
-    editbuffer_t *eb = &gen->editbuffer;
-    node_t *node = generate_setup(gen, opts->id_token_expand);
+    /* edit state lives only as long as one master's generation */
+    editbuffer_t editbuffer;
+    editbuffer_t *eb = &editbuffer;
+    node_t *node;
+
+    memset(eb, '\0', sizeof(editbuffer_t));
+    node = generate_setup(eb, gen, opts->id_token_expand);
 
     if (node == NULL)
 	return;
@@ -1081,15 +1125,8 @@ void generate_files(generator_t *gen,
 	 */
 	if (node->commit && opts->fromtime >= node->commit->date)
 	    goto Done;
-	if (node->commit != NULL && !node->commit->dead) {
-	    out_buffer_init(eb);
-	    if (eb->Gexpand < EXPANDKO)
-		expandedit(eb);
-	    else
-		snapshotedit(eb);
-	    hook(node, out_buffer_text(eb), out_buffer_count(eb), opts);
-	    out_buffer_cleanup(eb);
-	}
+	if (node->commit != NULL && !node->commit->dead)
+	    snapshot_sink(eb, node, sink, opts);
 	node = node->down;
 	if (node) {
 	    enter_branch(eb, node);
@@ -1114,7 +1151,7 @@ void generate_files(generator_t *gen,
 	process_delta(eb, node, EDIT);
     }
 Done:
-    generate_wrap(gen);
+    generate_wrap(eb);
 }
 
 /* end */
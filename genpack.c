@@ -0,0 +1,301 @@
+/*
+ * Memory-budget support for snapshot generation.
+ *
+ * Between digestion of a master and the export phase, the only thing
+ * kept from the parse is its generator: the version and patch lists plus
+ * the node tree that generate_stream() walks.  In the list form each
+ * delta costs three separate heap objects.  With a memory budget set
+ * we flatten the tree into one array of packed_node_t records right
+ * after digest, free the parse structures, and, once the in-core total
+ * of packed generators goes over budget, append further ones to an
+ * unlinked temporary file.  Just before generation the packed form is
+ * rehydrated into a single slab of nodes, versions and patches.
+ *
+ * Packed records hold atom and commit pointers, which stay valid for
+ * the life of the process, so the spill file is only meaningful to the
+ * process that wrote it.  The checkpoint code in checkpoint.c reuses the
+ * packed form, translating those pointers into table indices.
+ */
+
+#include <unistd.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
+
+#include "cvs.h"
+
+static int spill_fd = -1;
+static off_t spill_end;
+static size_t resident;
+#ifdef THREADS
+static pthread_mutex_t spill_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif /* THREADS */
+
+static int
+compare_node_address(const void *a, const void *b)
+/* order node pointers by address, for binary search */
+{
+    const node_t *x = *(node_t * const *)a, *y = *(node_t * const *)b;
+
+    if (x < y)
+	return -1;
+    return x > y;
+}
+
+static serial_t
+node_index(node_t **sorted, serial_t n, node_t *node)
+/* map a node pointer to its 1-origin packed index */
+{
+    node_t **hit;
+
+    if (node == NULL)
+	return NO_NODE;
+    hit = bsearch(&node, sorted, n, sizeof(node_t *), compare_node_address);
+    if (hit == NULL)
+	fatal_error("internal error - node missing from hash while packing");
+    return (serial_t)(hit - sorted) + 1;
+}
+
+static void
+generator_pack(generator_t *gen)
+/* flatten a generator's node tree, releasing the parse structures */
+{
+    node_t **nodes, *p;
+    packed_node_t *pn;
+    serial_t i, n = 0;
+
+    gen->npacked = gen->nodehash.nentries;
+    if (gen->nodehash.head_node == NULL || gen->npacked == 0) {
+	generator_free(gen);
+	gen->npacked = 0;
+	return;
+    }
+
+    nodes = xmalloc(sizeof(node_t *) * gen->npacked, __func__);
+    for (i = 0; i <= gen->nodehash.mask; i++)
+	if ((p = gen->nodehash.table[i]) != NULL)
+	    nodes[n++] = p;
+    qsort(nodes, n, sizeof(node_t *), compare_node_address);
+
+    gen->packed = xcalloc(n, sizeof(packed_node_t), "packed generator");
+    for (i = 0; i < n; i++) {
+	p = nodes[i];
+	pn = (packed_node_t *)gen->packed + i;
+	pn->number = p->number;
+	pn->commit = p->commit;
+	pn->starts = p->starts;
+	pn->to = node_index(nodes, n, p->to);
+	pn->down = node_index(nodes, n, p->down);
+	pn->sib = node_index(nodes, n, p->sib);
+	if (p->version) {
+	    pn->has_version = true;
+	    pn->author = p->version->author;
+	    pn->state = p->version->state;
+	    pn->date = p->version->date;
+	}
+	if (p->patch) {
+	    pn->has_patch = true;
+	    pn->log = p->patch->log;
+	    pn->offset = p->patch->text.offset;
+	    pn->length = p->patch->text.length;
+	}
+    }
+    gen->packed_head = node_index(nodes, n, gen->nodehash.head_node);
+    free(nodes);
+
+    generator_free(gen);
+    gen->npacked = n;
+}
+
+static void
+generator_spill(generator_t *gen)
+/* move a packed generator out of core; call with spill_mutex held */
+{
+    size_t len = gen->npacked * sizeof(packed_node_t);
+    const char *buf = gen->packed;
+    ssize_t done;
+
+    if (spill_fd == -1) {
+	char path[PATH_MAX];
+	char *tmp = getenv("TMPDIR");
+	if (tmp == NULL)
+	    tmp = "/tmp";
+	snprintf(path, sizeof(path), "%s/cvs-fast-export-spill-XXXXXX", tmp);
+	if ((spill_fd = mkstemp(path)) == -1)
+	    fatal_system_error("spill file creation failed");
+	unlink(path);
+    }
+
+    gen->spill_offset = spill_end;
+    while (len > 0) {
+	done = write(spill_fd, buf, len);
+	if (done < 0)
+	    fatal_system_error("spill file write failed");
+	buf += done;
+	len -= done;
+	spill_end += done;
+    }
+    free(gen->packed);
+    gen->packed = NULL;
+}
+
+static packed_node_t *
+spill_read(const generator_t *gen)
+/* read a copy of a spilled generator's nodes */
+{
+    size_t len = gen->npacked * sizeof(packed_node_t);
+    char *buf = xmalloc(len, "spilled generator");
+    off_t offset = gen->spill_offset;
+    size_t got = 0;
+    ssize_t done;
+
+    while (got < len) {
+	done = pread(spill_fd, buf + got, len - got, offset + got);
+	if (done <= 0)
+	    fatal_system_error("spill file read failed");
+	got += done;
+    }
+    return (packed_node_t *)buf;
+}
+
+static void
+generator_unspill(generator_t *gen)
+/* read a spilled generator back into core */
+{
+    gen->packed = spill_read(gen);
+}
+
+static void
+generator_admit(generator_t *gen, const size_t budget)
+/* account for a packed generator, spilling it if in-core total exceeds budget */
+{
+    size_t size = gen->npacked * sizeof(packed_node_t);
+
+#ifdef THREADS
+    pthread_mutex_lock(&spill_mutex);
+#endif /* THREADS */
+    if (resident + size > budget)
+	generator_spill(gen);
+    else
+	resident += size;
+#ifdef THREADS
+    pthread_mutex_unlock(&spill_mutex);
+#endif /* THREADS */
+}
+
+void
+generator_compact(generator_t *gen, const size_t budget)
+/* pack a digested generator, spilling it if in-core total exceeds budget */
+{
+    generator_pack(gen);
+    if (gen->npacked > 0)
+	generator_admit(gen, budget);
+}
+
+const packed_node_t *
+generator_packed(generator_t *gen)
+/* return a generator's packed nodes, packing it if need be */
+{
+    if (gen->packed == NULL && gen->npacked == 0) {
+	generator_pack(gen);
+	if (gen->npacked == 0)
+	    return NULL;
+	resident += gen->npacked * sizeof(packed_node_t);
+    } else if (gen->packed == NULL)
+	/* a spilled generator stays spilled; this copy is the caller's */
+	return spill_read(gen);
+    return gen->packed;
+}
+
+void
+generator_packed_done(const generator_t *gen, const packed_node_t *packed)
+/* finish with generator_packed()'s nodes, freeing them if read from spill */
+{
+    if (packed != NULL && packed != gen->packed)
+	free((packed_node_t *)packed);
+}
+
+void
+generator_discard(generator_t *gen)
+/* release a generator that will never be generated, in whatever form */
+{
+    if (gen->packed != NULL) {
+	resident -= gen->npacked * sizeof(packed_node_t);
+	free(gen->packed);
+	gen->packed = NULL;
+    }
+    gen->npacked = 0;
+    generator_free(gen);
+}
+
+void
+generator_adopt(generator_t *gen, packed_node_t *packed,
+		const serial_t n, const serial_t head, const size_t budget)
+/* install nodes packed elsewhere, e.g. read back from a checkpoint */
+{
+    gen->packed = packed;
+    gen->npacked = n;
+    gen->packed_head = head;
+    if (n > 0)
+	generator_admit(gen, budget > 0 ? budget : SIZE_MAX);
+}
+
+void
+generator_expand(generator_t *gen)
+/* rehydrate a packed generator so generate_stream() can walk it */
+{
+    packed_node_t *packed, *pn;
+    node_t *nodes, *node;
+    cvs_version *versions;
+    cvs_patch *patches;
+    serial_t i, n = gen->npacked;
+
+    if (n == 0)
+	return;
+
+    if (gen->packed == NULL)
+	generator_unspill(gen);
+    else
+	resident -= n * sizeof(packed_node_t);
+    packed = gen->packed;
+
+    gen->slab = xcalloc(n, sizeof(node_t) + sizeof(cvs_version) + sizeof(cvs_patch),
+			"generator slab");
+    nodes = gen->slab;
+    versions = (cvs_version *)(nodes + n);
+    patches = (cvs_patch *)(versions + n);
+    for (i = 0; i < n; i++) {
+	pn = packed + i;
+	node = nodes + i;
+	node->number = pn->number;
+	node->commit = pn->commit;
+	node->starts = pn->starts;
+	node->to = pn->to == NO_NODE ? NULL : nodes + pn->to - 1;
+	node->down = pn->down == NO_NODE ? NULL : nodes + pn->down - 1;
+	node->sib = pn->sib == NO_NODE ? NULL : nodes + pn->sib - 1;
+	if (pn->has_version) {
+	    node->version = versions + i;
+	    node->version->node = node;
+	    node->version->number = pn->number;
+	    node->version->author = pn->author;
+	    node->version->state = pn->state;
+	    node->version->date = pn->date;
+	}
+	if (pn->has_patch) {
+	    node->patch = patches + i;
+	    node->patch->node = node;
+	    node->patch->number = pn->number;
+	    node->patch->log = pn->log;
+	    node->patch->text.filename = gen->master_name;
+	    node->patch->text.offset = pn->offset;
+	    node->patch->text.length = pn->length;
+	}
+    }
+    gen->nodehash.head_node = gen->packed_head == NO_NODE ? NULL : nodes + gen->packed_head - 1;
+
+    free(gen->packed);
+    gen->packed = NULL;
+    gen->npacked = 0;
+}
+
+/* end */
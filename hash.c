@@ -1,9 +1,20 @@
 #include <stddef.h>
+#include <string.h>
 #include <sys/types.h>
 #include <inttypes.h>
 #include <limits.h>
 #include "hash.h"
 
+/*
+ * Three interchangeable hash functions sit behind the API in hash.h.
+ * Without a selection it is FNV-1a, a byte at a time.  Define
+ * HASH_WORD for a multiply-fold that takes a machine word per step, or
+ * HASH_CRC32C (the Makefile's choice) for crc32c, which uses the SSE4.2
+ * crc32 instruction when the processor has it and a table otherwise.
+ * Hash values only place things in tables, so the choice never shows
+ * in the output.  tests/hashbench compares them.
+ */
+
 /* FNV Hash Constants from http://isthe.com/chongo/tech/comp/fnv/ */
 
 //#if UINT_MAX == UINT32_MAX
@@ -24,7 +35,7 @@ fnv1a_hash_init(void)
 }
 
 static hash_t
-fnv1a_hash_mix_string(hash_t seed, const char *val) 
+fnv1a_hash_mix_string(hash_t seed, const char *val)
 {
     uint8_t c;
     while ((c = (uint8_t)*val++))
@@ -32,12 +43,6 @@ fnv1a_hash_mix_string(hash_t seed, const char *val)
     return seed;
 }
 
-static hash_t
-fnv1a_hash_string(const char *val)
-{
-    return fnv1a_hash_mix_string(HASH_FNV_INITIAL, val);
-}
-
 static hash_t
 fnv1a_hash_mix(hash_t seed, const char *val, size_t len)
 {
@@ -47,71 +52,179 @@ fnv1a_hash_mix(hash_t seed, const char *val, size_t len)
     return seed;
 }
 
+/*
+ * Word at a time: xor in eight bytes and multiply by the 64-bit golden
+ * ratio.  A short tail is padded with zeros and tagged with its length.
+ * A product's low bits only see the low bits of the word, and tables
+ * mask off the low bits, so the result goes through the murmur3
+ * finalizer before it is cut to 32 bits.
+ */
+#define HASH_WORD_MULT	0x9E3779B97F4A7C15ULL
+#define HASH_WORD_FMIX	0xFF51AFD7ED558CCDULL
+
+static hash_t
+word_hash_init(void)
+{
+    return HASH_FNV_INITIAL;
+}
+
 static hash_t
-fnv1a_hash_value(const char *val, size_t len)
+word_hash_mix(hash_t seed, const char *val, size_t len)
 {
-    return fnv1a_hash_mix(HASH_FNV_INITIAL, val, len);
+    uint64_t h = seed, w;
+
+    for (; len >= sizeof(w); val += sizeof(w), len -= sizeof(w)) {
+	memcpy(&w, val, sizeof(w));
+	h = (h ^ w) * HASH_WORD_MULT;
+	h ^= h >> 32;
+    }
+    if (len > 0) {
+	w = (uint64_t)len << 56;
+	memcpy(&w, val, len);
+	h = (h ^ w) * HASH_WORD_MULT;
+    }
+    h ^= h >> 33;
+    h *= HASH_WORD_FMIX;
+    h ^= h >> 33;
+    return (hash_t)h;
 }
 
+static hash_t
+word_hash_mix_string(hash_t seed, const char *val)
+{
+    return word_hash_mix(seed, val, strlen(val));
+}
 
-static hash_t crc32_table[256];
+/*
+ * crc32c (Castagnoli).  The hardware and table versions compute the
+ * same value; neither inverts it at the end, so that one result can
+ * seed the next mix.
+ */
+static hash_t crc32c_table[256];
 
 static void
-generate_crc32_table(void)
+generate_crc32c_table(void)
 {
     hash_t	c, p;
     int		n, m;
 
-    p = 0xedb88320;
+    p = 0x82f63b78;
     for (n = 0; n < 256; n++) {
 	c = n;
 	for (m = 0; m < 8; m++)
 	    c = (c >> 1) ^ ((c & 1) ? p : 0);
-	crc32_table[n] = c;
+	crc32c_table[n] = c;
     }
 }
 
 static hash_t
-crc32(const char *string)
+crc32c_soft(hash_t crc, const char *val, size_t len)
 {
-    hash_t		crc32 = ~0;
-    unsigned char	c;
+    const unsigned char *s = (const unsigned char *)val;
 
-    if (crc32_table[1] == 0) generate_crc32_table();
-    while ((c = (unsigned char) *string++))
-	crc32 = (crc32 >> 8) ^ crc32_table[(crc32 ^ c) & 0xff];
-    return ~crc32;
+    if (crc32c_table[1] == 0) generate_crc32c_table();
+    while (len--)
+	crc = (crc >> 8) ^ crc32c_table[(crc ^ *s++) & 0xff];
+    return crc;
 }
 
+static hash_t (*crc32c_mix)(hash_t, const char *, size_t) = crc32c_soft;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_CRC32C_SSE42
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static hash_t
+crc32c_sse42(hash_t crc, const char *val, size_t len)
+{
+    uint64_t c = crc, w;
+
+    for (; len >= sizeof(w); val += sizeof(w), len -= sizeof(w)) {
+	memcpy(&w, val, sizeof(w));
+	c = _mm_crc32_u64(c, w);
+    }
+    while (len--)
+	c = _mm_crc32_u8((uint32_t)c, (unsigned char)*val++);
+    return (hash_t)c;
+}
+#endif /* __GNUC__ && __x86_64__ */
+
+#ifdef __GNUC__
+__attribute__((constructor))
+static void
+crc32c_select(void)
+/* set up crc32c before any thread can hash */
+{
+    generate_crc32c_table();
+#ifdef HAVE_CRC32C_SSE42
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+	crc32c_mix = crc32c_sse42;
+#endif /* HAVE_CRC32C_SSE42 */
+}
+#endif /* __GNUC__ */
+
+static hash_t
+crc32c_hash_init(void)
+{
+    return ~(hash_t)0;
+}
+
+static hash_t
+crc32c_hash_mix(hash_t seed, const char *val, size_t len)
+{
+    return crc32c_mix(seed, val, len);
+}
+
+static hash_t
+crc32c_hash_mix_string(hash_t seed, const char *val)
+{
+    return crc32c_mix(seed, val, strlen(val));
+}
+
+#if defined(HASH_CRC32C)
+#define backend_init		crc32c_hash_init
+#define backend_mix		crc32c_hash_mix
+#define backend_mix_string	crc32c_hash_mix_string
+#elif defined(HASH_WORD)
+#define backend_init		word_hash_init
+#define backend_mix		word_hash_mix
+#define backend_mix_string	word_hash_mix_string
+#else
+#define backend_init		fnv1a_hash_init
+#define backend_mix		fnv1a_hash_mix
+#define backend_mix_string	fnv1a_hash_mix_string
+#endif
+
 hash_t
 hash_init(void)
 {
-    return fnv1a_hash_init();
+    return backend_init();
 }
 
 hash_t
 hash_string(const char *val)
 {
-    return fnv1a_hash_string(val);
+    return backend_mix_string(backend_init(), val);
 }
 
 hash_t
 hash_mix(hash_t seed, const char *val, size_t len)
 {
-    return fnv1a_hash_mix(seed, val, len);
+    return backend_mix(seed, val, len);
 }
 
 hash_t
 hash_value(const char *val, size_t len)
 {
-    return fnv1a_hash_value(val, len);
+    return backend_mix(backend_init(), val, len);
 }
 
 hash_t
 hash_mix_string(hash_t seed, const char *val)
 {
-    return fnv1a_hash_mix_string(seed, val);
+    return backend_mix_string(seed, val);
 }
 
 //end
-
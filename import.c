@@ -16,6 +16,8 @@
  *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
  */
 #include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #ifdef THREADS
@@ -39,6 +41,7 @@ typedef struct _rev_filename {
 typedef struct _rev_file {
     const char *name;
     const char *rectified;
+    path_node *node;
 } rev_file;
 /*
  * Ugh...least painful way to make some stuff that isn't thread-local
@@ -57,6 +60,7 @@ static volatile int         err;
 
 static int total_files, striplen;
 static int verbose;
+static size_t memory_budget;
 
 #ifdef THREADS
 static pthread_mutex_t revlist_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -64,12 +68,75 @@ static pthread_mutex_t enqueue_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t *workers;
 #endif /* THREADS */
 
+typedef struct _tag_run {
+    /* where a master's tags sit in its worker's staging buffer */
+    const tag_stage *stage;
+    size_t first, count;
+} tag_run;
+
 typedef struct _analysis {
     cvstime_t skew_vulnerable;
     unsigned int total_revisions;
     generator_t generator;
+    tag_run tags;
+    digest_stats digest;
 } analysis_t;
 
+#define DIGEST_SLOWEST	10	/* masters shown by digest_report() */
+
+typedef struct _slow_master {
+    /* a master that took long to digest, see digest_note() */
+    const char		*name;
+    double		seconds;
+    digest_stats	stats;
+} slow_master;
+
+static slow_master          slowest[DIGEST_SLOWEST];
+static int                  nslowest;
+static tag_run              *tag_runs;
+static tag_stage            *tag_stages;	/* one per worker */
+static int                  nworkers;
+
+/*
+ * Directory-walk mode.  Instead of reading a file list, the analysis
+ * workers walk the tree themselves, taking directories off one queue
+ * and the masters found in them off another, so parsing starts while
+ * the walk is still going.  Results land in per-master records whose
+ * addresses stay put as the set grows; when everything is parsed the
+ * records are sorted and copied into the usual arrays.
+ */
+typedef struct _walk_dir {
+    struct _walk_dir	*next;
+    char		*path;	/* relative to the walk root; allocated inline */
+} walk_dir;
+
+typedef struct _walk_master {
+    struct _walk_master	*next;
+    rev_file		file;
+    cvs_master		cm;
+    rev_master		rm;
+    generator_t		generator;
+    tag_run		tags;
+} walk_master;
+
+static const char	*walk_root;
+static int		walk_fd = -1;
+static bool		walk_promiscuous;
+static walk_dir		*dir_queue;
+static walk_master	*master_queue;
+static walk_master	**found;
+static size_t		nfound, maxfound;
+static volatile int	walking;	/* workers busy reading a directory */
+static off_t		walk_textsize;
+/* the strip length, as for a file list, is only known once it stops shrinking */
+static const char	*walk_first;	/* first master found */
+static int		walk_floor;	/* the root and its slash */
+static bool		walk_settled;
+static walk_master	*walk_held;	/* found before it settled */
+#ifdef THREADS
+static pthread_cond_t	walk_cond = PTHREAD_COND_INITIALIZER;
+#endif /* THREADS */
+
 static cvs_master *
 sort_cvs_masters(cvs_master *list);
 
@@ -128,7 +195,8 @@ atom_rectify_name(const char *raw)
 }
 
 static void
-rev_list_file(rev_file *file, analysis_t *out, cvs_master *cm, rev_master *rm) 
+rev_list_file(rev_file *file, analysis_t *out, cvs_master *cm, rev_master *rm,
+	      tag_stage *stage)
 {
     struct stat	buf;
     yyscan_t scanner;
@@ -151,6 +219,14 @@ rev_list_file(rev_file *file, analysis_t *out, cvs_master *cm, rev_master *rm)
     cvs->export_name = file->rectified;
     cvs->mode = buf.st_mode;
     cvs->verbose = verbose;
+    cvs->tag_stage = stage;
+    out->tags.stage = stage;
+    out->tags.first = stage->count;
+
+    /* the trie has already worked out where this master goes */
+    rm->name = file->rectified;
+    rm->fileop_name = file->node->fileop_name;
+    rm->dir = &file->node->parent->dir;
 
     yylex_init(&scanner);
     yyset_in(in, scanner);
@@ -162,9 +238,58 @@ rev_list_file(rev_file *file, analysis_t *out, cvs_master *cm, rev_master *rm)
     out->total_revisions = cvs->nversions;
     out->skew_vulnerable = cvs->skew_vulnerable;
     out->generator = cvs->gen;
+    out->tags.count = stage->count - out->tags.first;
+    out->digest = cvs->digest;
     cvs_file_free(cvs);
 }
 
+static void
+digest_note(const analysis_t *out)
+/* under -p, keep the slowest masters to digest; the caller serializes */
+{
+    double	seconds = 0;
+    int		i;
+
+    if (!progress)
+	return;
+    for (i = 0; i < DIGEST_PHASES; i++)
+	seconds += out->digest.seconds[i];
+    if (nslowest == DIGEST_SLOWEST && seconds <= slowest[nslowest - 1].seconds)
+	return;
+    if (nslowest < DIGEST_SLOWEST)
+	nslowest++;
+    for (i = nslowest - 1; i > 0 && slowest[i - 1].seconds < seconds; i--)
+	slowest[i] = slowest[i - 1];
+    slowest[i].name = out->generator.master_name;
+    slowest[i].seconds = seconds;
+    slowest[i].stats = out->digest;
+}
+
+static void
+digest_report(void)
+/* under -p, show where the time went in digesting the slowest masters */
+{
+    static const char *phases[DIGEST_PHASES] = {
+	"build", "vendor", "graft", "refs", "sort", "tail",
+    };
+    int i, p;
+
+    if (!progress || nslowest == 0)
+	return;
+    fprintf(STATUS, "Slowest masters to digest, in seconds:\n%7s", "total");
+    for (p = 0; p < DIGEST_PHASES; p++)
+	fprintf(STATUS, " %7s", phases[p]);
+    fprintf(STATUS, " %9s %8s %8s  master\n", "revisions", "branches", "symbols");
+    for (i = 0; i < nslowest; i++) {
+	fprintf(STATUS, "%7.3f", slowest[i].seconds);
+	for (p = 0; p < DIGEST_PHASES; p++)
+	    fprintf(STATUS, " %7.3f", slowest[i].stats.seconds[p]);
+	fprintf(STATUS, " %9u %8d %8d  %s\n",
+		(unsigned)slowest[i].stats.nversions, slowest[i].stats.nheads,
+		slowest[i].stats.nsymbols, slowest[i].name);
+    }
+}
+
 static int
 strcommonendingwith(const char *a, const char *b, char endc)
 /* return the length of the common prefix of strings a and b ending with endc */
@@ -186,7 +311,7 @@ strcommonendingwith(const char *a, const char *b, char endc)
 }
 
 static void *worker(void *arg)
-/* consume masters off the queue */
+/* consume masters off the queue; arg is the worker's tag stage */
 {
     analysis_t out = {0, 0};
     size_t     i;
@@ -206,7 +331,10 @@ static void *worker(void *arg)
 	    return(NULL);
 
 	/* process it */
-	rev_list_file(&sorted_files[i], &out, &cvs_masters[i], &rev_masters[i]);
+	rev_list_file(&sorted_files[i], &out, &cvs_masters[i], &rev_masters[i],
+		      (tag_stage *)arg);
+	if (memory_budget > 0)
+	    generator_compact(&out.generator, memory_budget);
 
 	/* pass it to the next stage */
 #ifdef THREADS
@@ -214,8 +342,252 @@ static void *worker(void *arg)
 	    pthread_mutex_lock(&revlist_mutex);
 #endif /* THREADS */
 	generators[i] = out.generator;
+	tag_runs[i] = out.tags;
 	progress_jump(++load_current_file);
 	total_revisions += out.total_revisions;
+	digest_note(&out);
+	if (out.skew_vulnerable > skew_vulnerable)
+	    skew_vulnerable = out.skew_vulnerable;
+#ifdef THREADS
+	if (threads > 1)
+	    pthread_mutex_unlock(&revlist_mutex);
+#endif /* THREADS */
+    }
+}
+
+static void
+walk_queue(walk_master *wm)
+/* name a master and queue it for parsing; the caller holds the lock */
+{
+    wm->file.rectified = atom_rectify_name(wm->file.name);
+    wm->file.node = path_trie_insert(wm->file.rectified);
+    wm->next = master_queue;
+    master_queue = wm;
+}
+
+static void
+walk_settle(void)
+/* the strip length is final; queue the masters held back for it */
+{
+    walk_master *wm;
+
+    walk_settled = true;
+    while ((wm = walk_held) != NULL) {
+	walk_held = wm->next;
+	walk_queue(wm);
+    }
+#ifdef THREADS
+    if (threads > 1)
+	pthread_cond_broadcast(&walk_cond);
+#endif /* THREADS */
+}
+
+static void
+walk_found(walk_master *wm)
+/*
+ * Narrow the strip length the way analyze_masters() does for a file
+ * list, to the longest directory prefix common to every master (or
+ * to -s, if that is shorter), and queue the master once that can no
+ * longer change.  Parsing only waits while every master found so far
+ * is under one subdirectory of the root; in a module with files at
+ * its top, the first master settles it.  The caller holds the lock.
+ */
+{
+    int c;
+
+    if (walk_settled) {
+	walk_queue(wm);
+	return;
+    }
+    if (walk_first == NULL) {
+	walk_first = wm->file.name;
+	if (striplen < 0)
+	    striplen = strrchr(walk_first, '/') - walk_first + 1;
+    } else if ((c = strcommonendingwith(wm->file.name, walk_first, '/')) < striplen)
+	striplen = c;
+    wm->next = walk_held;
+    walk_held = wm;
+    if (striplen <= walk_floor)
+	walk_settle();
+}
+
+static void
+walk_directory(walk_dir *wd)
+/* read one directory, queueing the subdirectories and masters in it */
+{
+    char	    path[PATH_MAX];
+    walk_dir	    *dirs = NULL, *nd;
+    walk_master	    *masters = NULL, *wm;
+    walk_master	    **batch = NULL;
+    size_t	    nbatch = 0, maxbatch = 0;
+    off_t	    textsize = 0;
+    struct dirent   *de;
+    struct stat	    stb;
+    DIR		    *dp;
+    int		    dfd, rootlen, len;
+    bool	    isdir;
+
+    dfd = openat(walk_fd, wd->path[0] ? wd->path : ".", O_RDONLY | O_DIRECTORY);
+    if (dfd == -1 || (dp = fdopendir(dfd)) == NULL) {
+	warn("cannot read directory %s/%s: %s\n", walk_root, wd->path, strerror(errno));
+	if (dfd != -1)
+	    close(dfd);
+	free(wd);
+	return;
+    }
+
+    rootlen = snprintf(path, sizeof(path), "%s/%s%s",
+		       walk_root, wd->path, wd->path[0] ? "/" : "");
+    while ((de = readdir(dp)) != NULL) {
+	const char *name = de->d_name;
+
+	if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+	    continue;
+	len = strlen(name);
+	if (rootlen + len >= (int)sizeof(path))
+	    fatal_error("File name %s%s\n too long\n", path, name);
+	memcpy(path + rootlen, name, len + 1);
+
+	/* like find(1), don't follow symlinks to directories */
+#ifdef DT_DIR
+	if (de->d_type != DT_UNKNOWN)
+	    isdir = (de->d_type == DT_DIR);
+	else
+#endif /* DT_DIR */
+	{
+	    if (fstatat(dfd, name, &stb, AT_SYMLINK_NOFOLLOW) != 0)
+		continue;
+	    isdir = S_ISDIR(stb.st_mode);
+	}
+	if (isdir) {
+	    if (!walk_promiscuous && strstr(name, "CVSROOT") != NULL)
+		continue;
+	    len = strlen(path) - strlen(walk_root) - 1;
+	    nd = xmalloc(sizeof(walk_dir) + len + 1, "directory walk");
+	    nd->path = (char *)(nd + 1);
+	    memcpy(nd->path, path + strlen(walk_root) + 1, len + 1);
+	    nd->next = dirs;
+	    dirs = nd;
+	    continue;
+	}
+
+	if (!walk_promiscuous) {
+	    if (len < 2 || name[len - 1] != 'v' || name[len - 2] != ',')
+		continue;
+	    if (strstr(path, "CVSROOT") != NULL)
+		continue;
+	}
+	if (fstatat(dfd, name, &stb, 0) != 0 || S_ISDIR(stb.st_mode))
+	    continue;
+	textsize += stb.st_size;
+
+	wm = xcalloc(1, sizeof(walk_master), "directory walk");
+	wm->file.name = atom(path);
+	wm->next = masters;
+	masters = wm;
+	if (nbatch == maxbatch) {
+	    maxbatch = maxbatch ? maxbatch * 2 : 64;
+	    batch = xrealloc(batch, maxbatch * sizeof(walk_master *), "directory walk");
+	}
+	batch[nbatch++] = wm;
+    }
+    closedir(dp);
+    free(wd);
+
+    /* publish everything found here in one go */
+#ifdef THREADS
+    if (threads > 1)
+	pthread_mutex_lock(&enqueue_mutex);
+#endif /* THREADS */
+    while ((nd = dirs) != NULL) {
+	dirs = nd->next;
+	nd->next = dir_queue;
+	dir_queue = nd;
+    }
+    while ((wm = masters) != NULL) {
+	masters = wm->next;
+	walk_found(wm);
+    }
+    if (nfound + nbatch > maxfound) {
+	maxfound = (nfound + nbatch) * 2;
+	found = xrealloc(found, maxfound * sizeof(walk_master *), "directory walk");
+    }
+    memcpy(found + nfound, batch, nbatch * sizeof(walk_master *));
+    nfound += nbatch;
+    walk_textsize += textsize;
+    walking--;
+#ifdef THREADS
+    if (threads > 1) {
+	pthread_cond_broadcast(&walk_cond);
+	pthread_mutex_unlock(&enqueue_mutex);
+    }
+#endif /* THREADS */
+    free(batch);
+}
+
+static void *walk_worker(void *arg)
+/* walk directories and consume the masters found in them; arg as worker() */
+{
+    analysis_t out = {0, 0};
+    walk_dir	*wd;
+    walk_master	*wm;
+
+    for (;;)
+    {
+	/* directories first, so the master queue stays fed */
+#ifdef THREADS
+	if (threads > 1)
+	    pthread_mutex_lock(&enqueue_mutex);
+#endif /* THREADS */
+	for (;;) {
+	    wd = dir_queue;
+	    wm = master_queue;
+	    if (wd != NULL) {
+		dir_queue = wd->next;
+		walking++;
+		break;
+	    }
+	    if (wm != NULL) {
+		master_queue = wm->next;
+		break;
+	    }
+	    if (walking == 0) {
+		if (walk_held == NULL)
+		    break;
+		/* the walk is over, so the prefix is as short as it gets */
+		walk_settle();
+		continue;
+	    }
+#ifdef THREADS
+	    pthread_cond_wait(&walk_cond, &enqueue_mutex);
+#endif /* THREADS */
+	}
+#ifdef THREADS
+	if (threads > 1)
+	    pthread_mutex_unlock(&enqueue_mutex);
+#endif /* THREADS */
+	if (wd != NULL) {
+	    walk_directory(wd);
+	    continue;
+	}
+	if (wm == NULL)
+	    return(NULL);
+
+	/* process it */
+	rev_list_file(&wm->file, &out, &wm->cm, &wm->rm, (tag_stage *)arg);
+	if (memory_budget > 0)
+	    generator_compact(&out.generator, memory_budget);
+
+	/* pass it to the next stage */
+#ifdef THREADS
+	if (threads > 1)
+	    pthread_mutex_lock(&revlist_mutex);
+#endif /* THREADS */
+	wm->generator = out.generator;
+	wm->tags = out.tags;
+	progress_jump(++load_current_file);
+	total_revisions += out.total_revisions;
+	digest_note(&out);
 	if (out.skew_vulnerable > skew_vulnerable)
 	    skew_vulnerable = out.skew_vulnerable;
 #ifdef THREADS
@@ -299,12 +671,113 @@ path_deep_compare(const void *a, const void *b)
     return compar;
 }
 
-static int 
-file_compare(const void *f1, const void *f2)
+static void
+walk_masters(const char *root, import_options_t *analyzer, forest_t *forest)
+/* find and parse the masters under a directory at the same time */
 {
-    rev_file r1 = *(rev_file *)f1;
-    rev_file r2 = *(rev_file *)f2;
-    return path_deep_compare(r1.rectified, r2.rectified);
+    char	name[PATH_MAX];
+    walk_dir	*wd;
+    walk_master	**sorted;
+    size_t	i, j;
+    int		len;
+#ifdef THREADS
+    pthread_attr_t  attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+#endif /* THREADS */
+
+    /* names are rectified as they would be for find(1) output from the root */
+    len = strlen(root);
+    while (len > 1 && root[len - 1] == '/')
+	len--;
+    if (len >= (int)sizeof(name))
+	fatal_error("File name %s\n too long\n", root);
+    memcpy(name, root, len);
+    name[len] = '\0';
+    walk_root = atom(name);
+    if ((walk_fd = open(walk_root, O_RDONLY | O_DIRECTORY)) == -1)
+	fatal_system_error("%s", walk_root);
+    striplen = analyzer->striplen > 0 ? analyzer->striplen : -1;
+    walk_floor = len + 1;
+    walk_first = NULL;
+    walk_held = NULL;
+    walk_settled = striplen > 0 && striplen <= walk_floor;
+    walk_promiscuous = analyzer->promiscuous;
+
+    load_current_file = 0;
+    verbose = analyzer->verbose;
+    memory_budget = analyzer->memory_budget;
+
+    wd = xcalloc(1, sizeof(walk_dir) + 1, "directory walk");
+    wd->path = (char *)(wd + 1);
+    dir_queue = wd;
+
+#ifdef THREADS
+    if (threads > 1)
+	snprintf(name, sizeof(name),
+		 "Walking and analyzing masters with %d threads...", threads);
+    else
+#endif /* THREADS */
+	strcpy(name, "Walking and analyzing masters...");
+    progress_begin(name, NO_MAX);
+#ifdef THREADS
+    if (threads > 1)
+    {
+	int i;
+
+	workers = (pthread_t *)xcalloc(threads, sizeof(pthread_t), __func__);
+	for (i = 0; i < threads; i++)
+	    pthread_create(&workers[i], &attr, walk_worker, &tag_stages[i]);
+
+	/* Wait for all the threads to die off. */
+	for (i = 0; i < threads; i++)
+	    pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&enqueue_mutex);
+	pthread_mutex_destroy(&revlist_mutex);
+	pthread_cond_destroy(&walk_cond);
+    }
+    else
+#endif /* THREADS */
+	walk_worker(&tag_stages[0]);
+    close(walk_fd);
+
+    progress_end("done, %.3fKB in %d files, %d revisions",
+		 (walk_textsize/1024.0), (int)nfound, (int)total_revisions);
+    digest_report();
+
+    /*
+     * Masters were parsed in whatever order the walk found them; put
+     * them in the path_deep_compare order the later stages expect,
+     * which the path trie gives without comparing names.
+     * Commits point back at their rev_master, so repoint them at the
+     * master's new home, and tags were held back so they can be filed
+     * in this order too.
+     */
+    path_trie_order();
+    sorted = xmalloc(nfound * sizeof(walk_master *), "directory walk");
+    for (i = 0; i < nfound; i++)
+	sorted[found[i]->file.node->slot++] = found[i];
+    free(found);
+    found = sorted;
+    generators = xcalloc(sizeof(generator_t), nfound, "Generators");
+    cvs_masters = xcalloc(nfound, sizeof(cvs_master), "cvs_masters");
+    rev_masters = xcalloc(nfound, sizeof(rev_master), "rev_masters");
+    for (i = 0; i < nfound; i++) {
+	cvs_masters[i] = found[i]->cm;
+	rev_masters[i] = found[i]->rm;
+	generators[i] = found[i]->generator;
+	for (j = 0; j < rev_masters[i].ncommits; j++)
+	    rev_masters[i].commits[j].master = &rev_masters[i];
+	tag_replay(found[i]->tags.stage, found[i]->tags.first,
+		   found[i]->tags.count, found[i]->file.name);
+	free(found[i]);
+    }
+    free(found);
+
+    forest->filecount = nfound;
+    forest->textsize = walk_textsize;
 }
 
 void analyze_masters(int argc, char *argv[], 
@@ -315,6 +788,7 @@ void analyze_masters(int argc, char *argv[],
     char	    name[PATH_MAX];
     const char      *last = NULL;
     char	    *file;
+    rev_file	    *unsorted;
     size_t	    i, j = 1;
     int		    c;
 #ifdef THREADS
@@ -323,9 +797,20 @@ void analyze_masters(int argc, char *argv[],
     /* Initialize and reinforce default thread non-detached attribute */
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+#endif /* THREADS */
 
-    atom_dir_init();
+    path_trie_init();
+    nworkers = 1;
+#ifdef THREADS
+    if (threads > 1)
+	nworkers = threads;
 #endif /* THREADS */
+    tag_stages = xcalloc(nworkers, sizeof(tag_stage), "tag staging");
+
+    if (analyzer->walk_root != NULL) {
+	walk_masters(analyzer->walk_root, analyzer, forest);
+	goto done;
+    }
 
     striplen = analyzer->striplen;
 
@@ -379,33 +864,40 @@ void analyze_masters(int argc, char *argv[],
 	fn->file = atom(file);
 	last = fn->file;
 	total_files++;
-	if (progress && total_files % 100 == 0)
-	    progress_jump(total_files);
+	progress_jump(total_files);
     }
     forest->filecount = total_files;
 
     generators = xcalloc(sizeof(generator_t), total_files, "Generators");
+    unsorted = xmalloc(sizeof(rev_file) * total_files, "sorted_files");
     sorted_files = xmalloc(sizeof(rev_file) * total_files, "sorted_files");
+    tag_runs = xmalloc(sizeof(tag_run) * total_files, "tag staging");
     cvs_masters = xcalloc(total_files, sizeof(cvs_master), "cvs_masters");
-    rev_masters = xmalloc(sizeof(rev_master) * total_files, "rev_masters");
+    rev_masters = xcalloc(total_files, sizeof(rev_master), "rev_masters");
     fn_n = total_files;
     i = 0;
     rev_filename *tn;
     for (fn = fn_head; fn; fn = tn) {
 	tn = fn->next;
-	sorted_files[i].name = fn->file;
-	sorted_files[i++].rectified = atom_rectify_name(fn->file);
+	unsorted[i].name = fn->file;
+	unsorted[i].rectified = atom_rectify_name(fn->file);
+	unsorted[i].node = path_trie_insert(unsorted[i].rectified);
+	i++;
 	free(fn);
     }
     /*
-     * Sort list of files in path_deep_compare order of output name.
+     * Put the files in path_deep_compare order of output name, which
+     * walking the path trie yields directly.
      * cvs_masters and rev_masters will be mainteined in this order.
      * This causes commits to come out in correct pack order.
      * It also causes operations to come out in correct fileop_sort order.
      * Note some output names are different to input names.
      * e.g. .cvsignore becomes .gitignore
      */
-    qsort(sorted_files, total_files, sizeof(rev_file), file_compare);
+    path_trie_order();
+    for (i = 0; i < (size_t)total_files; i++)
+	sorted_files[unsorted[i].node->slot++] = unsorted[i];
+    free(unsorted);
 	
     progress_end("done, %.3fKB in %d files",
 		 (forest->textsize/1024.0), forest->filecount);
@@ -413,6 +905,7 @@ void analyze_masters(int argc, char *argv[],
     /* things that must be visible to inner functions */
     load_current_file = 0;
     verbose = analyzer->verbose;
+    memory_budget = analyzer->memory_budget;
 
     /*
      * Analyze the files for CVS revision structure.
@@ -437,7 +930,7 @@ void analyze_masters(int argc, char *argv[],
 
 	workers = (pthread_t *)xcalloc(threads, sizeof(pthread_t), __func__);
 	for (i = 0; i < threads; i++)
-	    pthread_create(&workers[i], &attr, worker, NULL);
+	    pthread_create(&workers[i], &attr, worker, &tag_stages[i]);
 
         /* Wait for all the threads to die off. */
 	for (i = 0; i < threads; i++)
@@ -448,15 +941,25 @@ void analyze_masters(int argc, char *argv[],
     }
     else
 #endif /* THREADS */
-	worker(NULL);
+	worker(&tag_stages[0]);
 
     progress_end("done, %d revisions", (int)total_revisions);
+    digest_report();
+    for (i = 0; i < (size_t)total_files; i++)
+	tag_replay(tag_runs[i].stage, tag_runs[i].first, tag_runs[i].count,
+		   sorted_files[i].name);
+    free(tag_runs);
     free(sorted_files);
 
+done:
+    for (i = 0; i < (size_t)nworkers; i++)
+	free(tag_stages[i].tags);
+    free(tag_stages);
     forest->errcount = err;
     forest->total_revisions = total_revisions;
     forest->skew_vulnerable = skew_vulnerable;
     forest->cvs = cvs_masters;
+    forest->masters = rev_masters;
     forest->generators = (generator_t *)generators;
 }
 
@@ -125,6 +125,35 @@ static time_t convert_date(const char *dte)
     }
 }
 
+static size_t convert_size(const char *size)
+/* accept a byte count with an optional K, M or G suffix */
+{
+    char *end;
+    unsigned long long n;
+    int shift = 0;
+
+    /* strtoull() would take a sign, and negate the count silently */
+    if (!isdigit((unsigned char)*size))
+	fatal_error("cannot interpret memory size %s\n", size);
+    errno = 0;
+    n = strtoull(size, &end, 10);
+    switch (*end) {
+    case 'G': case 'g':
+	shift += 10;
+	/* fall through */
+    case 'M': case 'm':
+	shift += 10;
+	/* fall through */
+    case 'K': case 'k':
+	shift += 10;
+	end++;
+	break;
+    }
+    if (errno == ERANGE || *end != '\0' || n > SIZE_MAX >> shift)
+	fatal_error("cannot interpret memory size %s\n", size);
+    return (size_t)n << shift;
+}
+
 static void print_sizes(void)
 {
     printf("sizeof(char *)        = %zu\n", sizeof(char *));
@@ -178,6 +207,9 @@ static void gather_stats(const char *legend)
     (void)clock_gettime(CLOCK_REALTIME, &checkpoints[ncheckpoints].timespec);
     (void)getrusage(RUSAGE_SELF, &checkpoints[ncheckpoints].rusage);
     ncheckpoints++;
+#ifdef MEMSTATS
+    memstats_phase(legend);
+#endif /* MEMSTATS */
 }
 
 int
@@ -194,6 +226,10 @@ main(int argc, char **argv)
 	.id_token_expand =  EXPANDUNSPEC,
     };
     export_stats_t	export_stats;
+    const char	    *save_checkpoint = NULL, *load_checkpoint = NULL;
+#ifdef ZLIB
+    bool	    gzip_output = false;
+#endif /* ZLIB */
 
 #if defined(__GLIBC__)
     /* 
@@ -234,10 +270,19 @@ main(int argc, char **argv)
             { "threads",	    0, 0, 't' },
             { "canonical",          0, 0, 'C' },
             { "fast",               0, 0, 'F' },
+            { "stream",             0, 0, 'B' },
+            { "blob-buffer",        1, 0, 'b' },
             { "embed-id",           0, 0, 'E' },
+            { "max-memory",         1, 0, 'M' },
+            { "save-checkpoint",    1, 0, 'W' },
+            { "load-checkpoint",    1, 0, 'L' },
+            { "walk",               1, 0, 'D' },
+            { "gzip",               0, 0, 'z' },
+            { "shard-dir",          1, 0, 'O' },
+            { "shards",             1, 0, 'n' },
 	    { "sizes",              0, 0, 'S' },	/* undocumented */
 	};
-	int c = getopt_long(argc, argv, "+hVw:l:grvqaA:R:Tk:e:s:pPi:t:CFSE", options, NULL);
+	int c = getopt_long(argc, argv, "+hVw:l:grvqaA:R:Tk:e:s:pPi:t:CFBb:SEM:W:L:D:zO:n:", options, NULL);
 	if (c < 0)
 	    break;
 	switch(c) {
@@ -264,6 +309,13 @@ main(int argc, char **argv)
 		   " -i --incremental TIME           Incremental dump beginning after specified RFC3339-format time.\n"
 		   " -t --threads N                  Use threaded scheduler for CVS master analyses.\n"
 		   " -E --embed-id                   Embed CVS revisions in the commit messages.\n"
+		   " -M --max-memory SIZE            Spill parsed metadata to disk beyond SIZE bytes.\n"
+		   " -W --save-checkpoint FILE       Save the merged commit graph to FILE.\n"
+		   " -L --load-checkpoint FILE       Export from a saved commit graph, skipping analysis.\n"
+		   " -D --walk DIR                   Find masters by walking DIR instead of reading names.\n"
+		   " -z --gzip                       Compress the output with gzip, in parallel.\n"
+		   " -O --shard-dir DIR              Split the stream into files in DIR for parallel import.\n"
+		   " -n --shards N                   Number of branch shards beside trunk's (default: one per CPU).\n"
 		   "\n"
 		   "Example: find | cvs-fast-export\n");
 	    return 0;
@@ -349,6 +401,47 @@ main(int argc, char **argv)
 	case 'F':
 	    export_options.reportmode = fast;
 	    break;
+	case 'B':
+	    export_options.reportmode = streaming;
+	    break;
+	case 'b':
+	    assert(optarg);
+	    export_options.reportmode = canonical;
+	    export_options.blob_budget = convert_size(optarg);
+	    break;
+	case 'M':
+	    assert(optarg);
+	    import_options.memory_budget = convert_size(optarg);
+	    break;
+	case 'W':
+	    assert(optarg);
+	    save_checkpoint = optarg;
+	    break;
+	case 'L':
+	    assert(optarg);
+	    load_checkpoint = optarg;
+	    break;
+	case 'D':
+	    assert(optarg);
+	    import_options.walk_root = optarg;
+	    break;
+	case 'z':
+#ifdef ZLIB
+	    gzip_output = true;
+#else
+	    fatal_error("not built with zlib, -z is unavailable.\n");
+#endif /* ZLIB */
+	    break;
+	case 'O':
+	    assert(optarg);
+	    export_options.shard_dir = optarg;
+	    break;
+	case 'n':
+	    assert(optarg);
+	    export_options.shards = atoi(optarg);
+	    if (export_options.shards < 1)
+		fatal_error("the shard count must be at least 1.\n");
+	    break;
 	case 'S':
 	    print_sizes();
 	    return 0;
@@ -362,6 +455,34 @@ main(int argc, char **argv)
 	if (export_options.embed_ids)
 	    fatal_error("The options --reposurgeon and --embed-id cannot be combined.\n");
     }
+    if (load_checkpoint) {
+	if (optind < argc)
+	    fatal_error("The option --load-checkpoint cannot be combined with master file arguments.\n");
+	if (import_options.walk_root)
+	    fatal_error("The options --load-checkpoint and --walk cannot be combined.\n");
+    }
+    if (import_options.walk_root) {
+	if (optind < argc)
+	    fatal_error("The option --walk cannot be combined with master file arguments.\n");
+    }
+    if (export_options.shard_dir) {
+	if (export_options.reportmode == canonical
+	    || export_options.reportmode == streaming)
+	    fatal_error("The option --shard-dir needs fast order and cannot be combined with -C, -B or -b.\n");
+#ifdef ZLIB
+	if (gzip_output)
+	    fatal_error("The options --shard-dir and --gzip cannot be combined.\n");
+#endif /* ZLIB */
+	export_options.reportmode = fast;
+	if (export_options.shards == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+	    export_options.shards = sysconf(_SC_NPROCESSORS_ONLN);
+#endif /*  _SC_NPROCESSORS_ONLN */
+	    if (export_options.shards < 1)
+		export_options.shards = 1;
+	}
+    } else if (export_options.shards != 0)
+	fatal_error("The option --shards needs --shard-dir.\n");
 
     argv[optind-1] = argv[0];
     argv += optind-1;
@@ -374,19 +495,41 @@ main(int argc, char **argv)
 #endif /*  _SC_NPROCESSORS_ONLN */
 #endif
 
+#ifdef ZLIB
+    if (gzip_output)
+#ifdef THREADS
+	compress_begin(threads > 1);
+#else
+	compress_begin(false);
+#endif /* THREADS */
+#endif /* ZLIB */
+
     gather_stats("before parsing");
 
-    /* build CVS structures by parsing masters; may read stdin */
-    analyze_masters(argc, argv, &import_options, &forest);
+    if (load_checkpoint) {
+	/* pick up the DAG where an earlier --save-checkpoint run left it */
+	checkpoint_load(load_checkpoint, &forest, import_options.memory_budget);
+
+	gather_stats("after checkpoint load");
+    } else {
+	/* build CVS structures by parsing masters; may read stdin */
+	analyze_masters(argc, argv, &import_options, &forest);
+
+	gather_stats("after parsing");
 
-    gather_stats("after parsing");
+	/* commit set coalescence happens here */
+	forest.git = merge_to_changesets(forest.cvs, 
+					 forest.filecount,
+					 import_options.verbose);
 
-    /* commit set coalescence happens here */
-    forest.git = merge_to_changesets(forest.cvs, 
-				     forest.filecount,
-				     import_options.verbose);
+	gather_stats("after branch merge");
 
-    gather_stats("after branch merge");
+	if (save_checkpoint) {
+	    checkpoint_save(save_checkpoint, &forest);
+
+	    gather_stats("after checkpoint save");
+	}
+    }
 
     /* report on the DAG */
     if (forest.git) {
@@ -405,6 +548,11 @@ main(int argc, char **argv)
 	}
     }
 
+#ifdef ZLIB
+    if (gzip_output && !compress_end())
+	fatal_error("the compressor failed; output is incomplete.\n");
+#endif /* ZLIB */
+
     gather_stats("total");
 
     if (progress)
@@ -425,6 +573,9 @@ main(int argc, char **argv)
 		export_stats.snapsize / 1000000.0,
 		natoms,
 		(int)(export_stats.export_total_commits / elapsed));
+#ifdef MEMSTATS
+	memstats_report(STATUS);
+#endif /* MEMSTATS */
     }
 
     if (LOGFILE != stderr) {
@@ -0,0 +1,291 @@
+/*
+ * Allocation accounting, by the legend every x*alloc() call carries.
+ *
+ * Compiled in only with MEMSTATS.  cvs.h then routes free() through
+ * xfree(), and every live block made by the allocators in utils.c is
+ * remembered with its size and legend, so each legend has a count of
+ * allocations, the bytes it has asked for in all, the bytes it holds
+ * now, and the most it has held at once, both overall and in each of
+ * the phases main.c marks with its statistics checkpoints.  Blocks
+ * from elsewhere (the scanner's buffers, say) are freed untouched.
+ *
+ * Sizes are the sizes requested, not what malloc rounds them to, so
+ * the totals are a floor on the heap the program uses.  Everything
+ * here runs under one lock; this is a diagnostic build, and it is
+ * slow on purpose rather than by accident.
+ */
+
+#include "cvs.h"
+#include "hash.h"
+
+#ifdef MEMSTATS
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
+
+#undef free
+
+#define MAX_PHASES	8	/* more than main.c has checkpoints */
+#define MEMSTATS_TOP	20	/* legends shown in the report */
+
+typedef struct _legend_stats {
+    struct _legend_stats	*next;
+    const char			*name;
+    size_t			allocs;
+    size_t			total;		/* bytes ever requested */
+    size_t			live;		/* bytes held now */
+    size_t			peak;
+    size_t			phase_peak[MAX_PHASES];
+} legend_stats;
+
+typedef struct _block {
+    struct _block	*next;
+    const void		*ptr;
+    size_t		size;
+    legend_stats	*legend;
+} block;
+
+/* legends, hashed on their text, since __func__ copies may differ */
+#define LEGEND_BUCKETS	256
+static legend_stats *legends[LEGEND_BUCKETS];
+static size_t nlegends;
+
+/* live blocks, hashed on address */
+static block **blocks, *spare_blocks;
+static size_t nblocks, block_buckets;
+
+/* the sum over all legends */
+static legend_stats all = {.name = "(all)"};
+
+static const char *phase_names[MAX_PHASES];
+static int phase;
+
+#ifdef THREADS
+static pthread_mutex_t memstats_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define memstats_lock()		pthread_mutex_lock(&memstats_mutex)
+#define memstats_unlock()	pthread_mutex_unlock(&memstats_mutex)
+#else
+#define memstats_lock()
+#define memstats_unlock()
+#endif /* THREADS */
+
+static legend_stats *
+find_legend(const char *name)
+/* find or make the record for a legend */
+{
+    legend_stats **head = &legends[hash_string(name) & (LEGEND_BUCKETS - 1)];
+    legend_stats *ls;
+
+    for (ls = *head; ls; ls = ls->next)
+	if (ls->name == name || strcmp(ls->name, name) == 0)
+	    return ls;
+    ls = calloc(1, sizeof(legend_stats));
+    if (ls == NULL)
+	fatal_system_error("Out of memory in memstats");
+    ls->name = name;
+    ls->next = *head;
+    *head = ls;
+    nlegends++;
+    return ls;
+}
+
+static size_t
+block_hash(const void *ptr, size_t nbuckets)
+{
+    return HASH_VALUE(ptr) & (nbuckets - 1);
+}
+
+static void
+grow_blocks(void)
+/* double the address table */
+{
+    size_t	newsize = block_buckets ? block_buckets * 2 : 65536, i;
+    block	**newblocks = calloc(newsize, sizeof(block *));
+    block	*b, *next;
+
+    if (newblocks == NULL)
+	fatal_system_error("Out of memory in memstats");
+    for (i = 0; i < block_buckets; i++)
+	for (b = blocks[i]; b; b = next) {
+	    size_t h = block_hash(b->ptr, newsize);
+	    next = b->next;
+	    b->next = newblocks[h];
+	    newblocks[h] = b;
+	}
+    free(blocks);
+    blocks = newblocks;
+    block_buckets = newsize;
+}
+
+static void
+charge(legend_stats *ls, size_t size)
+/* add a live block's bytes to a legend and note any new peak */
+{
+    ls->live += size;
+    if (ls->live > ls->peak)
+	ls->peak = ls->live;
+    if (ls->live > ls->phase_peak[phase])
+	ls->phase_peak[phase] = ls->live;
+}
+
+static void
+remember(const void *ptr, size_t size, const char *legend)
+/* record a new block; the caller holds the lock */
+{
+    legend_stats	*ls = find_legend(legend);
+    block		*b;
+    size_t		h;
+
+    if (nblocks >= block_buckets)
+	grow_blocks();
+    if ((b = spare_blocks) != NULL)
+	spare_blocks = b->next;
+    else if ((b = malloc(sizeof(block))) == NULL)
+	fatal_system_error("Out of memory in memstats");
+    h = block_hash(ptr, block_buckets);
+    b->ptr = ptr;
+    b->size = size;
+    b->legend = ls;
+    b->next = blocks[h];
+    blocks[h] = b;
+    nblocks++;
+
+    ls->allocs++;
+    ls->total += size;
+    charge(ls, size);
+    all.allocs++;
+    all.total += size;
+    charge(&all, size);
+}
+
+static void
+forget(const void *ptr)
+/* drop a block's record, if it has one; the caller holds the lock */
+{
+    block **bp, *b;
+
+    if (ptr == NULL || block_buckets == 0)
+	return;
+    for (bp = &blocks[block_hash(ptr, block_buckets)]; (b = *bp); bp = &b->next)
+	if (b->ptr == ptr) {
+	    *bp = b->next;
+	    b->legend->live -= b->size;
+	    all.live -= b->size;
+	    b->next = spare_blocks;
+	    spare_blocks = b;
+	    nblocks--;
+	    return;
+	}
+}
+
+void
+memstats_alloc(const void *ptr, size_t size, const char *legend)
+/* account for a block fresh from the allocator */
+{
+    memstats_lock();
+    remember(ptr, size, legend);
+    memstats_unlock();
+}
+
+void
+memstats_free(const void *ptr)
+/* stop accounting for a block before it is freed or reallocated */
+{
+    memstats_lock();
+    forget(ptr);
+    memstats_unlock();
+}
+
+void
+xfree(void *ptr)
+/* free(), for blocks the accounting may know about */
+{
+    memstats_free(ptr);
+    free(ptr);
+}
+
+void
+memstats_phase(const char *name)
+/* end the current phase; name is the checkpoint that ends it */
+{
+    legend_stats	*ls;
+    int			i;
+
+    memstats_lock();
+    if (phase < MAX_PHASES - 1) {
+	phase_names[phase++] = name;
+	for (i = 0; i < LEGEND_BUCKETS; i++)
+	    for (ls = legends[i]; ls; ls = ls->next)
+		ls->phase_peak[phase] = ls->live;
+	all.phase_peak[phase] = all.live;
+    }
+    memstats_unlock();
+}
+
+static int
+peak_compare(const void *a, const void *b)
+/* biggest peak first, then by name so the report is stable */
+{
+    const legend_stats *p = *(legend_stats * const *)a;
+    const legend_stats *q = *(legend_stats * const *)b;
+
+    if (p->peak != q->peak)
+	return p->peak < q->peak ? 1 : -1;
+    return strcmp(p->name, q->name);
+}
+
+static void
+report_line(FILE *fp, const legend_stats *ls, int nphases)
+{
+    int i;
+
+    fprintf(fp, "%24.24s %10zu %10zu %9zu", ls->name, ls->allocs,
+	    ls->total / 1024, ls->peak / 1024);
+    for (i = 1; i <= nphases; i++)
+	fprintf(fp, " %15zu", ls->phase_peak[i] / 1024);
+    fputc('\n', fp);
+}
+
+void
+memstats_report(FILE *fp)
+/*
+ * List the legends with the biggest peaks: allocations, KB requested,
+ * peak KB held, then the peak KB held in each phase, headed by the
+ * checkpoint that ended it less its "after ".  The first phase, up to
+ * "before parsing", is only option handling and is left out.
+ */
+{
+    legend_stats	**sorted, *ls;
+    size_t		n = 0, i;
+    int			nphases, p;
+
+    memstats_lock();
+    nphases = phase - 1;
+    sorted = malloc(nlegends * sizeof(legend_stats *));
+    if (sorted == NULL)
+	fatal_system_error("Out of memory in memstats");
+    for (i = 0; i < LEGEND_BUCKETS; i++)
+	for (ls = legends[i]; ls; ls = ls->next)
+	    sorted[n++] = ls;
+    qsort(sorted, n, sizeof(legend_stats *), peak_compare);
+
+    fprintf(fp, "Allocation by legend, top %d of %zu (KB):\n",
+	    MEMSTATS_TOP, nlegends);
+    fprintf(fp, "%24s %10s %10s %9s", "legend", "allocs", "total", "peak");
+    for (p = 1; p <= nphases; p++) {
+	const char *name = phase_names[p];
+
+	if (strncmp(name, "after ", 6) == 0)
+	    name += 6;
+	fprintf(fp, " %15.15s", name);
+    }
+    fputc('\n', fp);
+    for (i = 0; i < n && i < MEMSTATS_TOP; i++)
+	report_line(fp, sorted[i], nphases);
+    report_line(fp, &all, nphases);
+    free(sorted);
+    memstats_unlock();
+}
+#endif /* MEMSTATS */
+
+/* end */
@@ -16,6 +16,7 @@
  *  59 Temple Place, Suite 330, Boston, MA 02111-1307 USA.
  */
 #include "cvs.h"
+#include "hash.h"
 #include "revdir.h"
 /*
  * These functions analyze a CVS revlist into a changeset DAG.
@@ -24,28 +25,31 @@
  */
 
 /*
- * Pack the dead flag into the commit pointer so we can avoid dereferencing 
- * in the inner loop. Also keep the dir near the packed pointer
- * as it is used in the inner loop.
+ * Pack the dead flag beside the commit handle so we can avoid dereferencing 
+ * in the inner loop. Also keep the dir index near the packed handle
+ * as it is used in the inner loop.  Both are 32 bits, so an entry is
+ * half the size two pointers would be.
  */
 typedef struct _revision {
-    /* packed commit pointer and dead flag */
-    uintptr_t packed;
-    const master_dir *dir;
+    /* packed commit handle and dead flag */
+    uint32_t packed;
+    serial_t dir;
 } revision_t;
 
 /* 
  * Once set, dir doesn't change, so have an initial pack that sets dir
  * and a later pack that doesn't
  */
-#define REVISION_T_PACK(rev, commit) (rev).packed = ((uintptr_t)(commit) | ((commit) ? ((commit)->dead) : 0))
+#define REVISION_T_PACK(rev, commit) (rev).packed = \
+	((commit) ? (cvs_commit_handle(commit) << 1 | (commit)->dead) : 0)
 #define REVISION_T_PACK_INIT(rev, commit) do {	\
 	REVISION_T_PACK(rev, commit);		\
-	(rev).dir = (commit)->master->dir;	\
+	(rev).dir = (commit)->master->dir->index;	\
     } while (0)
 #define REVISION_T_DEAD(rev) (((rev).packed) & 1)
-#define COMMIT_MASK (~(uintptr_t)0 ^ 1)
-#define REVISION_T_COMMIT(rev) (cvs_commit *)(((rev).packed) & (COMMIT_MASK))
+#define REVISION_T_HANDLE(rev) ((commit_handle)((rev).packed >> 1))
+#define REVISION_T_COMMIT(rev) \
+	((rev).packed ? cvs_commit_at(REVISION_T_HANDLE(rev)) : (cvs_commit *)NULL)
 
 /* 
  * Be aware using these macros that they bind to whatever revisions array 
@@ -53,7 +57,7 @@ typedef struct _revision {
  */
 #define DEAD(index) (REVISION_T_DEAD(revisions[(index)]))
 #define REVISIONS(index) (REVISION_T_COMMIT(revisions[(index)]))
-#define DIR(index) (revisions[(index)].dir)
+#define DIR(index) (master_dirs[revisions[(index)].dir])
 
 static rev_ref *
 rev_find_head(head_list *rl, const char *name)
@@ -243,15 +247,48 @@ static revision_t       *revisions = NULL;
 static size_t           *sort_buf = NULL;
 static size_t           *sort_temp = NULL;
 
+/*
+ * Index of the pending revisions by the metadata that must agree for
+ * two of them to coalesce, so that cliques can be collected without
+ * walking the date-sorted window.  Revisions with a commitid are keyed
+ * on that alone; older ones on author, log and the commit-window-wide
+ * time slice their date falls in.  Slots hashing to the same bucket
+ * are chained through clique_next/clique_prev; NO_SLOT ends a chain.
+ */
+#define NO_SLOT	((size_t)-1)
+static size_t           *clique_table = NULL;
+static size_t           *clique_next = NULL;
+static size_t           *clique_prev = NULL;
+static size_t           *clique = NULL;
+static size_t           clique_mask;
+/* pending non-tailed revisions that still have history to walk */
+static int              live_pending;
+
+/* how much work the clique index does, compared to a window scan */
+static struct {
+    unsigned long cliques;	/* cliques formed */
+    unsigned long probed;	/* index entries compared against a leader */
+    unsigned long windowed;	/* entries a window scan would have compared */
+} clique_stats;
+
+#define LIVE_PENDING(c)	((c)->parent || !(c)->dead)
+
 static void
 alloc_revisions(size_t nrev)
 /* Allocate buffers for merge_branches */
 {
     if (srevisions < nrev) {
 	/* As first branch is master, don't expect this to be hit more than once */
+	size_t nbucket = 1;
+	while (nbucket < nrev)
+	    nbucket <<= 1;
 	revisions = xrealloc(revisions, nrev * sizeof(revision_t), __func__);
 	sort_buf = xrealloc(sort_buf, nrev * sizeof(size_t), __func__);
 	sort_temp = xrealloc(sort_temp, nrev * sizeof(size_t), __func__);
+	clique_table = xrealloc(clique_table, nbucket * sizeof(size_t), __func__);
+	clique_next = xrealloc(clique_next, nrev * sizeof(size_t), __func__);
+	clique_prev = xrealloc(clique_prev, nrev * sizeof(size_t), __func__);
+	clique = xrealloc(clique, nrev * sizeof(size_t), __func__);
 	srevisions = nrev;
     }
 }
@@ -263,10 +300,119 @@ merge_branches_cleanup(void)
 	free(revisions);
 	free(sort_buf);
 	free(sort_temp);
+	free(clique_table);
+	free(clique_next);
+	free(clique_prev);
+	free(clique);
 	srevisions = 0;
     }
 }
 
+static void
+clique_index_init(size_t nrev)
+/* empty the clique index, sizing it for nrev revisions */
+{
+    size_t nbucket = 1;
+
+    while (nbucket < nrev)
+	nbucket <<= 1;
+    clique_mask = nbucket - 1;
+    while (nbucket--)
+	clique_table[nbucket] = NO_SLOT;
+}
+
+static cvstime_t
+clique_slice(const cvstime_t date)
+/* the commit-window-wide time slice a date falls in */
+{
+    return commit_time_window > 0 ? date / commit_time_window : 0;
+}
+
+static size_t
+clique_bucket(const cvs_commit *c, const cvstime_t slice)
+/* index bucket for commits that could coalesce with c in a time slice */
+{
+    if (c->commitid)
+	return HASH_VALUE(c->commitid) & clique_mask;
+    else {
+	HASH_INIT(hash);
+	HASH_MIX(hash, c->author);
+	HASH_MIX(hash, c->log);
+	HASH_MIX(hash, slice);
+	return hash & clique_mask;
+    }
+}
+
+static void
+clique_index_add(size_t slot)
+/* enter a revision slot under the key of its current commit */
+{
+    const cvs_commit *c = REVISIONS(slot);
+    size_t bucket;
+
+    if (!c)
+	return;
+    bucket = clique_bucket(c, clique_slice(c->date));
+    clique_prev[slot] = NO_SLOT;
+    clique_next[slot] = clique_table[bucket];
+    if (clique_table[bucket] != NO_SLOT)
+	clique_prev[clique_table[bucket]] = slot;
+    clique_table[bucket] = slot;
+}
+
+static void
+clique_index_remove(size_t slot)
+/* drop a revision slot from the index; call before changing its commit */
+{
+    const cvs_commit *c = REVISIONS(slot);
+
+    if (!c)
+	return;
+    if (clique_prev[slot] != NO_SLOT)
+	clique_next[clique_prev[slot]] = clique_next[slot];
+    else
+	clique_table[clique_bucket(c, clique_slice(c->date))] = clique_next[slot];
+    if (clique_next[slot] != NO_SLOT)
+	clique_prev[clique_next[slot]] = clique_prev[slot];
+}
+
+static size_t
+clique_probe(const cvs_commit *latest, size_t bucket, size_t nclique)
+/* append to clique the slots in one index bucket that coalesce with latest */
+{
+    size_t slot;
+
+    for (slot = clique_table[bucket]; slot != NO_SLOT; slot = clique_next[slot]) {
+	const cvs_commit *c = REVISIONS(slot);
+	clique_stats.probed++;
+	if (!c->tailed && (c == latest
+			   || (cvs_commit_time_close(latest->date, c->date)
+			       && cvs_commit_match(c, latest))))
+	    clique[nclique++] = slot;
+    }
+    return nclique;
+}
+
+static size_t
+clique_gather(const cvs_commit *latest)
+/* collect into clique the pending slots that coalesce with latest */
+{
+    cvstime_t slice = clique_slice(latest->date);
+    size_t bucket = clique_bucket(latest, slice);
+    size_t nclique = clique_probe(latest, bucket, 0);
+
+    /*
+     * latest is the newest pending revision, so anything close enough
+     * to it lies in its own time slice or the one before.
+     */
+    if (!latest->commitid && slice > 0) {
+	size_t older = clique_bucket(latest, slice - 1);
+	if (older != bucket)
+	    nclique = clique_probe(latest, older, nclique);
+    }
+    return nclique;
+}
+
 static void
 git_commit_cleanup(void)
 /* clean up after rev list merge */
@@ -299,8 +445,8 @@ git_commit_build(revision_t *revisions, const cvs_commit *leader,
 
     revdir_pack_init();
     for (n = 0; n < nrevisions; n++) {
-	if (REVISIONS(n) && !(DEAD(n))) {
-	    revdir_pack_add(REVISIONS(n), DIR(n));
+	if (revisions[n].packed && !(DEAD(n))) {
+	    revdir_pack_add(REVISION_T_HANDLE(revisions[n]), DIR(n));
 	}
     }
     revdir_pack_end(&commit->revdir);   
@@ -309,7 +455,7 @@ git_commit_build(revision_t *revisions, const cvs_commit *leader,
     debugmsg("commit_build: %p\n", commit);
 
 #if !defined STREAMDIR
-    for (n = 0; n < nfile; n++)
+    for (n = 0; n < nrevisions; n++)
 	if (REVISIONS(n))
 	    debugmsg("%s\n", REVISIONS(n)->master->name);
 #endif
@@ -503,6 +649,103 @@ resort_revs (size_t skip, size_t nrev, size_t resort) {
     }
 }
 
+static size_t
+clique_window_end(const cvs_commit *latest, size_t lo, size_t hi)
+/* first index of sort_buf[lo..hi) too old or too tailed to join latest */
+{
+    while (lo < hi) {
+	size_t mid = lo + (hi - lo) / 2;
+	const cvs_commit *c = REVISIONS(sort_buf[mid]);
+	if (!c->tailed && cvs_commit_time_close(latest->date, c->date))
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static void
+revision_advance(size_t slot, git_commit *commit, const time_t birth)
+/*
+ * A CVS revision has joined commit; step its slot down to the parent
+ * revision, or drop the slot if its branch has ended.
+ */
+{
+    cvs_commit *c = REVISIONS(slot);
+    cvs_commit *to;
+    bool live = false;
+
+#ifdef GITSPACEDEBUG
+    if (c->gitspace) {
+	warn("CVS commit allocated to multiple git commits: ");
+	dump_number_file(LOGFILE, c->master->name, c->number);
+	warn("\n");
+    } else
+#endif /* GITSPACEDEBUG */
+	c->gitspace = commit;
+
+    clique_index_remove(slot);
+    if (LIVE_PENDING(c))
+	live_pending--;
+
+    to = c->parent;
+    /*
+     * CVS branch starts here?  If so, drop it out of
+     * the revision set and keep going.
+     */
+    if (!to)
+	goto Kill;
+
+    if (c->tail) {
+	/*
+	 * Adding file independently added on another
+	 * non-trunk branch.
+	 */
+	if (!to->parent && to->dead)
+	    goto Kill;
+	/*
+	 * If the parent is at the beginning of trunk
+	 * and it is younger than some events on our
+	 * branch, we have old CVS adding file
+	 * independently added on another branch.
+	 */
+	if (birth && time_compare(birth, to->date) < 0)
+	    goto Kill;
+	/*
+	 * XXX: we still can't be sure that it's
+	 * not a file added on trunk after parent
+	 * branch had forked off it but before
+	 * our branch's creation.
+	 */
+	to->tailed = true;
+    } else if (!to->dead) {
+	live = true;
+    } else {
+	/*
+	 * See if it's recent CVS adding a file
+	 * independently added on another branch.
+	 */
+	if (!to->parent)
+	    goto Kill;
+	if (to->tail && to->date == to->parent->date)
+	    goto Kill;
+	live = true;
+    }
+
+    /*
+     * Commit is either not tailed or passed all the special-case
+     * tests for tailed commits. Leave it in the set for the next
+     * changeset construction.
+     */
+    REVISION_T_PACK(revisions[slot], to);
+    clique_index_add(slot);
+    if (live)
+	live_pending++;
+    return;
+Kill:
+    REVISION_T_PACK(revisions[slot], (cvs_commit *)NULL);
+}
+
 static void
 merge_branches(rev_ref **branches, int nbranch,
 		  rev_ref *branch, git_repo *gl)
@@ -607,6 +850,15 @@ merge_branches(rev_ref **branches, int nbranch,
 	REVISION_T_PACK(revisions[n], (cvs_commit *)NULL);
     }
 
+    clique_index_init(nrev);
+    live_pending = 0;
+    for (n = 0; n < nrev; n++) {
+	cvs_commit *c = REVISIONS(n);
+	clique_index_add(n);
+	if (c && !c->tailed && LIVE_PENDING(c))
+	    live_pending++;
+    }
+
     /* Initial sort into null/date/tailed order */
     qsort(sort_buf, nrev, sizeof(size_t), compare_clique);
     size_t skip = 0;
@@ -646,108 +898,24 @@ merge_branches(rev_ref **branches, int nbranch,
 	 * a clique of matching CVS commits that will  be made into a 
 	 * matching gitspace commit on the next time around the loop.
 	 */
-	nlive = 0;
+	/*
+	 * Step down each CVS branch in the clique.  Its members are
+	 * exactly the pending revisions in the leader's index bucket
+	 * that match it, so only those need comparing.  Every member
+	 * lies before the end of the leader's time window in sort_buf,
+	 * which bounds how much of it has to be resorted afterwards.
+	 */
+	size_t end = clique_window_end(latest, skip, nrev), nclique, i;
 	/* worst case, we have to resort everything */
 	size_t resort = nbranch;
-	bool can_match = true;
-	for (n = skip; n < nrev; n++) {
-	    cvs_commit *c = REVISIONS(sort_buf[n]);
-	    cvs_commit *to;
-
-	    /*
-	     * Already got to parent branch?
-             * We've sorted the list so everything else is tailed
-	     */
-	    if (c->tailed)
-		break;
-
-	    if (c != latest && can_match && !cvs_commit_time_close(latest->date, c->date)) {
-		/*
-		 * Because we are in date order, once we hit something too
-                 * far off, we can't get anything else in the clique -
-                 * unless there are cases where things with the same commitid
-                 * have wildly differing dates.
-                 */
-		can_match = false;
-		/* how much of the array might now be unsorted */
-		resort = n - skip;
-	    }
-	    /* not affected? */
-	    if (c != latest && (!can_match || !cvs_commit_match(c, latest))) {
-		if (c->parent || !c->dead)
-		    nlive++;
-		/*
-		 * If we've found the clique, and at least one branch
-		 * is still live then bail.
-                 * Note, we are guaranteed to set resort before we get here
-                 */
-		if (!can_match && nlive > 0)
-		    break;
-		continue;
-	    }
-#ifdef GITSPACEDEBUG
-	    if (c->gitspace) {
-		warn("CVS commit allocated to multiple git commits: ");
-		dump_number_file(LOGFILE, c->master->name, c->number);
-		warn("\n");
-	    } else
-#endif /* GITSPACEDEBUG */
-		c->gitspace = commit;
-
-	    to = c->parent;
-	    /*
-	     * CVS branch starts here?  If so, drop it out of
-	     * the revision set and keep going.
-	     */
-	    if (!to)
-		goto Kill;
-
-	    if (c->tail) {
-		/*
-		 * Adding file independently added on another
-		 * non-trunk branch.
-		 */
-		if (!to->parent && to->dead)
-		    goto Kill;
-		/*
-		 * If the parent is at the beginning of trunk
-		 * and it is younger than some events on our
-		 * branch, we have old CVS adding file
-		 * independently added on another branch.
-		 */
-		if (birth && time_compare(birth, to->date) < 0)
-		    goto Kill;
-		/*
-		 * XXX: we still can't be sure that it's
-		 * not a file added on trunk after parent
-		 * branch had forked off it but before
-		 * our branch's creation.
-		 */
-		to->tailed = true;
-	    } else if (!to->dead) {
-		nlive++;
-	    } else {
-		/*
-		 * See if it's recent CVS adding a file
-		 * independently added on another branch.
-		 */
-		if (!to->parent)
-		    goto Kill;
-		if (to->tail && to->date == to->parent->date)
-		    goto Kill;
-		nlive++;
-	    }
-
-	    /*
-	     * Commit is either not tailed or passed all the special-case
-	     * tests for tailed commits. Leave it in the set for the next
-	     * changeset construction.
-	     */
-	    REVISION_T_PACK(revisions[sort_buf[n]], to);
-	    continue;
-	Kill:
-	    REVISION_T_PACK(revisions[sort_buf[n]], (cvs_commit *)NULL);
-	}
+	if (end < nrev && !REVISIONS(sort_buf[end])->tailed)
+	    resort = end - skip;
+	nclique = clique_gather(latest);
+	for (i = 0; i < nclique; i++)
+	    revision_advance(clique[i], commit, birth);
+	nlive = live_pending;
+	clique_stats.cliques++;
+	clique_stats.windowed += end - skip;
 	/* we've changed some revs to their parents. Resort */
 	resort_revs(skip, nrev, resort);
 
@@ -756,7 +924,6 @@ merge_branches(rev_ref **branches, int nbranch,
 	 * Sanity check that we've ordered things properly
 	 * oc is useful for a conditional breakpoint if not
 	 */
-	size_t i;
 	for (i = skip + 1; i < nrev; i++) {
 	    if (compare_clique(&sort_buf[i-1], &sort_buf[i]) > 0)
 		warn("Sort broken oc: %lu\n", oc);
@@ -1199,6 +1366,12 @@ merge_to_changesets(cvs_master *masters, size_t nmasters, int verbose)
     }
     merge_branches_cleanup();
     progress_end(NULL);
+
+    if (verbose)
+	debugmsg("%lu cliques: %lu index comparisons, %lu saved over window scan\n",
+		 clique_stats.cliques, clique_stats.probed,
+		 clique_stats.windowed > clique_stats.probed ?
+		 clique_stats.windowed - clique_stats.probed : 0);
     
 
 #ifdef GITSPACEDEBUG
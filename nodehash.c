@@ -2,17 +2,54 @@
  * The per-CVS-master node list this module builds and exports is used
  * during the analysis phase (only) to walk through all deltas and 
  * build them into snapshots.
+ *
+ * The nodes are found through an open-addressed table keyed on the
+ * address of the interned revision number.  It starts small and
+ * doubles whenever it would become half full, so a master with a
+ * handful of deltas costs a few slots and one with tens of thousands
+ * still finds a node in a probe or two.
  */
 
 #include "cvs.h"
 #include "hash.h"
 
+#define NODE_HASH_MIN	16	/* slots in a new table, a power of two */
+
 unsigned long
 hash_cvs_number(const cvs_number *const key)
 {
     return hash_value((const char *)key, sizeof(short) * (key->c + 1));
 }
 
+static node_t **
+node_slot(const nodehash_t *context, const cvs_number *const k)
+/* the slot holding the node for atom k, or the empty one it would go in */
+{
+    size_t i;
+
+    for (i = HASH_VALUE(k) & context->mask;
+	 context->table[i] && context->table[i]->number != k;
+	 i = (i + 1) & context->mask)
+	continue;
+    return &context->table[i];
+}
+
+static void
+node_hash_grow(nodehash_t *context)
+/* double the table, or make the first one */
+{
+    node_t	**old = context->table;
+    size_t	oldsize = old ? context->mask + 1 : 0, i;
+    size_t	size = old ? oldsize * 2 : NODE_HASH_MIN;
+
+    context->table = xcalloc(size, sizeof(node_t *), "node hash");
+    context->mask = size - 1;
+    for (i = 0; i < oldsize; i++)
+	if (old[i])
+	    *node_slot(context, old[i]->number) = old[i];
+    free(old);
+}
+
 static node_t *
 node_for_cvs_number(nodehash_t *context, const cvs_number *const n)
 /*
@@ -21,11 +58,13 @@ node_for_cvs_number(nodehash_t *context, const cvs_number *const n)
  */
 {
     const cvs_number *k = n;
-    node_t *p;
-    hash_t hash = hash_cvs_number(k) % NODE_HASH_SIZE;
-    for (p = context->table[hash]; p; p = p->hash_next)
-	if (p->number == k)
-	    return p;
+    node_t *p, **slot;
+
+    if (!context->table || (size_t)context->nentries * 2 >= context->mask)
+	node_hash_grow(context);
+    slot = node_slot(context, k);
+    if ((p = *slot) != NULL)
+	return p;
 
     /*
      * While it looks like a good idea, an attempt at slab allocation
@@ -35,8 +74,7 @@ node_for_cvs_number(nodehash_t *context, const cvs_number *const n)
      */
     p = xcalloc(1, sizeof(node_t), "hash number generation");
     p->number = k;
-    p->hash_next = context->table[hash];
-    context->table[hash] = p;
+    *slot = p;
     context->nentries++;
     return p;
 }
@@ -46,19 +84,12 @@ static node_t *find_parent(nodehash_t *context,
 /* find the parent node of the specified prefix of a release number */
 {
     cvs_number key;
-    const cvs_number *k;
-    node_t *p;
-    hash_t hash;
 
+    if (!context->table)
+	return NULL;
     memcpy(&key, n, sizeof(cvs_number));
     key.c -= depth;
-    k = atom_cvs_number(key);
-    hash = hash_cvs_number(k) % NODE_HASH_SIZE;
-    for (p = context->table[hash]; p; p = p->hash_next)
-	if (p->number == k)
-	    return p;
-
-    return NULL;
+    return *node_slot(context, atom_cvs_number(key));
 }
 
 void hash_version(nodehash_t *context, cvs_version *v)
@@ -106,16 +137,15 @@ void hash_branch(nodehash_t *context, cvs_branch *b)
 void clean_hash(nodehash_t *context)
 /* discard the node list */
 {
-    int i;
-    for (i = 0; i < NODE_HASH_SIZE; i++) {
-	node_t *p = context->table[i];
-	context->table[i] = NULL;
-	while (p) {
-	    node_t *q = p->hash_next;
-	    free(p);
-	    p = q;
-	}
+    size_t i;
+
+    if (context->table) {
+	for (i = 0; i <= context->mask; i++)
+	    free(context->table[i]);
+	free(context->table);
     }
+    context->table = NULL;
+    context->mask = 0;
     context->nentries = 0;
     context->head_node = NULL;
 }
@@ -173,22 +203,95 @@ static void try_pair(nodehash_t *context, node_t *a, node_t *b)
     }
 }
 
+typedef struct _keyed_version {
+    const cvs_number	*key;
+    cvs_version		*version;
+} keyed_version;
+
+static int
+branch_version_compare(const void *a, const void *b)
+/* group versions by branch key, in revision order within a branch */
+{
+    const keyed_version *x = a, *y = b;
+
+    if (x->key != y->key)
+	return x->key < y->key ? -1 : 1;
+    return cvs_number_compare(x->version->number, y->version->number);
+}
+
+static version_branch *
+branch_slot(const cvs_file *cvs, const cvs_number *key)
+/* the index slot for a branch key, or the empty one it would go in */
+{
+    size_t i;
+
+    for (i = HASH_VALUE(key) & cvs->branch_mask;
+	 cvs->branch_index[i].key && cvs->branch_index[i].key != key;
+	 i = (i + 1) & cvs->branch_mask)
+	continue;
+    return &cvs->branch_index[i];
+}
+
 /* entry points begin here */
 
+void
+cvs_version_index(cvs_file *cvs)
+/*
+ * Build the branch index cvs_find_version() uses: the master's
+ * versions sorted into runs by branch, and an open-addressed table
+ * from each branch's key to its run.
+ */
+{
+    cvs_version		*cv;
+    keyed_version	*kv;
+    version_branch	*vb;
+    serial_t		n = 0, i;
+    size_t		size = 8;
+
+    for (cv = cvs->gen.versions; cv; cv = cv->next)
+	n++;
+    kv = xmalloc((n ? n : 1) * sizeof(keyed_version), "version index");
+    for (i = 0, cv = cvs->gen.versions; cv; cv = cv->next, i++) {
+	kv[i].key = cvs_branch_key(cv->number);
+	kv[i].version = cv;
+    }
+    qsort(kv, n, sizeof(keyed_version), branch_version_compare);
+
+    while (size < 2 * (size_t)n)
+	size *= 2;
+    cvs->branch_versions = xmalloc((n ? n : 1) * sizeof(cvs_version *), "version index");
+    cvs->branch_index = xcalloc(size, sizeof(version_branch), "version index");
+    cvs->branch_mask = size - 1;
+    for (i = 0; i < n; i++) {
+	cvs->branch_versions[i] = kv[i].version;
+	vb = branch_slot(cvs, kv[i].key);
+	if (!vb->key) {
+	    vb->key = kv[i].key;
+	    vb->first = i;
+	}
+	vb->count++;
+    }
+    free(kv);
+}
+
 node_t *
 cvs_find_version(const cvs_file *cvs, const cvs_number *number)
-/* find the file version associated with the specified CVS release number */
+/* find the first version after the specified CVS release number on its branch */
 {
-    cvs_version *cv;
-    cvs_version	*nv = NULL;
+    const version_branch *vb = branch_slot(cvs, cvs_branch_key(number));
+    cvs_version	**v = cvs->branch_versions + vb->first;
+    serial_t	lo = 0, hi = vb->count;
 
-    for (cv = cvs->gen.versions; cv; cv = cv->next) {
-	if (cvs_same_branch(number, cv->number) &&
-	    cvs_number_compare(cv->number, number) > 0 &&
-	    (!nv || cvs_number_compare(nv->number, cv->number) > 0))
-	    nv = cv;
+    /* the trunk's run can hold versions before number; skip them */
+    while (lo < hi) {
+	serial_t mid = lo + (hi - lo) / 2;
+
+	if (cvs_number_compare(v[mid]->number, number) > 0)
+	    hi = mid;
+	else
+	    lo = mid + 1;
     }
-    return nv ? nv->node : NULL;
+    return lo < vb->count ? v[lo]->node : NULL;
 }
 
 void build_branches(nodehash_t *context)
@@ -198,13 +301,11 @@ void build_branches(nodehash_t *context)
 	return;
 
     node_t **v = xmalloc(sizeof(node_t *) * context->nentries, __func__), **p = v;
-    int i;
+    size_t i;
 
-    for (i = 0; i < NODE_HASH_SIZE; i++) {
-	node_t *q;
-	for (q = context->table[i]; q; q = q->hash_next)
-	    *p++ = q;
-    }
+    for (i = 0; i <= context->mask; i++)
+	if (context->table[i])
+	    *p++ = context->table[i];
     qsort(v, context->nentries, sizeof(node_t *), compare);
     /* only trunk? */
     if (v[context->nentries-1]->number->c == 2)
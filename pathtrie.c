@@ -0,0 +1,267 @@
+/*
+ * A trie of the rectified master names.
+ *
+ * Every master is inserted as it is found.  The directory nodes carry
+ * the master_dir records that commits point at, so a directory is
+ * interned once, by its parent and last component, rather than by
+ * hashing its full name; the file nodes carry the name each master
+ * gets in fileops.  When the file list is complete, path_trie_order()
+ * walks the trie to give every file node its place in the order of
+ * path_deep_compare(), so the masters never have to be sorted as
+ * whole strings.
+ *
+ * Insertion is not thread-safe; callers serialize it.  Once made,
+ * nodes never move, so their master_dir and fileop_name may be read
+ * at any time; the master_dirs index of them may move until insertion
+ * is over.
+ */
+
+#include "cvs.h"
+#include "hash.h"
+
+static path_node root;
+const master_dir *root_dir = NULL;
+
+/* every directory record by index, for callers that store 32-bit indices */
+const master_dir **master_dirs;
+static size_t ndirs, sdirs;
+
+/* children of every node, hashed on parent and component */
+static path_node **buckets;
+static size_t nbuckets, nnodes;
+
+static void
+add_dir(master_dir *dir)
+/* give a new directory record the next index */
+{
+    if (ndirs == sdirs) {
+	sdirs = sdirs ? sdirs * 2 : 1024;
+	master_dirs = xrealloc(master_dirs, sdirs * sizeof(master_dir *), "path trie");
+    }
+    dir->index = ndirs;
+    master_dirs[ndirs++] = dir;
+}
+
+void
+path_trie_init(void)
+/* set up the root; safe to call more than once */
+{
+    if (root_dir)
+	return;
+    root.dir.name = atom("");
+    root.dir.parent = NULL;
+    root.isdir = true;
+    nbuckets = 4096;
+    buckets = xcalloc(nbuckets, sizeof(path_node *), "path trie");
+    root_dir = &root.dir;
+    add_dir(&root.dir);
+}
+
+static size_t
+node_hash(const path_node *parent, const char *name, size_t len)
+{
+    return hash_mix(HASH_VALUE(parent), name, len);
+}
+
+static void
+rehash(void)
+/* double the bucket count */
+{
+    size_t	newsize = nbuckets * 2, i;
+    path_node	**newbuckets = xcalloc(newsize, sizeof(path_node *), "path trie");
+    path_node	*p, *next;
+
+    for (i = 0; i < nbuckets; i++)
+	for (p = buckets[i]; p; p = next) {
+	    size_t h = node_hash(p->parent, p->name, p->len) & (newsize - 1);
+	    next = p->hash_next;
+	    p->hash_next = newbuckets[h];
+	    newbuckets[h] = p;
+	}
+    free(buckets);
+    buckets = newbuckets;
+    nbuckets = newsize;
+}
+
+static path_node *
+child(path_node *parent, const char *path, const char *name, size_t len, bool isdir)
+/* find or make the child of parent with the given last component */
+{
+    path_node	**head = &buckets[node_hash(parent, name, len) & (nbuckets - 1)];
+    path_node	*p;
+
+    for (p = *head; p; p = p->hash_next)
+	if (p->parent == parent && p->isdir == isdir
+	    && p->len == len && memcmp(p->name, name, len) == 0)
+	    return p;
+
+    p = xcalloc(1, sizeof(path_node), "path trie");
+    p->parent = parent;
+    p->len = len;
+    p->isdir = isdir;
+    if (isdir) {
+	char buf[PATH_MAX];
+
+	memcpy(buf, path, name + len - path);
+	buf[name + len - path] = '\0';
+	p->dir.name = atom(buf);
+	p->dir.parent = &parent->dir;
+	add_dir(&p->dir);
+	p->name = p->dir.name + (name - path);
+	p->sibling = parent->subdirs;
+	parent->subdirs = p;
+    } else {
+	/* path is an atom, so the node can point into it */
+	p->name = name;
+	p->fileop_name = path;
+	if (len >= 10 && memcmp(name + len - 10, ".cvsignore", 10) == 0) {
+	    char buf[PATH_MAX];
+
+	    strcpy(buf, path);
+	    memcpy(buf + (name - path) + len - 9, "git", 3);
+	    p->fileop_name = atom(buf);
+	}
+	p->sibling = parent->files;
+	parent->files = p;
+    }
+    p->hash_next = *head;
+    *head = p;
+    if (++nnodes > nbuckets)
+	rehash();
+    return p;
+}
+
+static path_node *
+insert_dirs(const char *path, const char **last)
+/* make the directory nodes of path; *last is left at the final component */
+{
+    path_node	*node = &root;
+    const char	*s = path, *slash;
+
+    while ((slash = strchr(s, '/')) != NULL) {
+	/* an absolute name's leading slash belongs to its first directory */
+	if (slash != path)
+	    node = child(node, path, s, slash - s, true);
+	s = slash + 1;
+    }
+    *last = s;
+    return node;
+}
+
+path_node *
+path_trie_insert(const char *rectified)
+/* add a master by its rectified name (an atom) and return its file node */
+{
+    const char	*last;
+    path_node	*dir = insert_dirs(rectified, &last);
+    path_node	*file = child(dir, rectified, last, strlen(last), false);
+
+    file->nmasters++;
+    return file;
+}
+
+const master_dir *
+path_trie_dir(const char *dirname)
+/* find or make the directory record for a directory name */
+{
+    const char	*last;
+    path_node	*dir;
+
+    if (dirname[0] == '\0')
+	return &root.dir;
+    dir = insert_dirs(dirname, &last);
+    return &child(dir, dirname, last, strlen(last), true)->dir;
+}
+
+static int
+dir_compare(const void *a, const void *b)
+/* order directories as their names would sort with a trailing slash */
+{
+    const path_node *p = *(path_node * const *)a;
+    const path_node *q = *(path_node * const *)b;
+    size_t n = p->len < q->len ? p->len : q->len;
+    int c = memcmp(p->name, q->name, n);
+
+    if (c != 0 || p->len == q->len)
+	return c;
+    if (p->len < q->len)
+	return '/' - (unsigned char)q->name[n];
+    return (unsigned char)p->name[n] - '/';
+}
+
+static int
+file_compare(const void *a, const void *b)
+/* order files in the same directory as strcmp() would */
+{
+    const path_node *p = *(path_node * const *)a;
+    const path_node *q = *(path_node * const *)b;
+    size_t n = p->len < q->len ? p->len : q->len;
+    int c = memcmp(p->name, q->name, n);
+
+    return c != 0 ? c : (int)p->len - (int)q->len;
+}
+
+static path_node **
+sorted_children(path_node *list, size_t *count, int (*compare)(const void *, const void *),
+		path_node **vec, size_t *size)
+/* gather a sibling list into vec and sort it */
+{
+    size_t	n = 0;
+    path_node	*p;
+
+    for (p = list; p; p = p->sibling) {
+	if (n == *size) {
+	    *size = *size ? *size * 2 : 64;
+	    vec = xrealloc(vec, *size * sizeof(path_node *), "path trie");
+	}
+	vec[n++] = p;
+    }
+    if (n > 1)
+	qsort(vec, n, sizeof(path_node *), compare);
+    *count = n;
+    return vec;
+}
+
+static size_t
+order_dir(path_node *dir, size_t slot)
+/* assign slots below dir in path_deep_compare() order; subdirectories first */
+{
+    path_node	**vec = NULL, *p;
+    size_t	size = 0, n, i;
+
+    vec = sorted_children(dir->subdirs, &n, dir_compare, vec, &size);
+    /* keep them in order, so vec can be reused for the files */
+    dir->subdirs = NULL;
+    for (i = n; i-- > 0; ) {
+	vec[i]->sibling = dir->subdirs;
+	dir->subdirs = vec[i];
+    }
+    for (p = dir->subdirs; p; p = p->sibling)
+	slot = order_dir(p, slot);
+
+    vec = sorted_children(dir->files, &n, file_compare, vec, &size);
+    dir->files = NULL;
+    for (i = n; i-- > 0; ) {
+	vec[i]->sibling = dir->files;
+	dir->files = vec[i];
+    }
+    for (p = dir->files; p; p = p->sibling) {
+	p->slot = slot;
+	slot += p->nmasters;
+    }
+    free(vec);
+    return slot;
+}
+
+size_t
+path_trie_order(void)
+/*
+ * Number the file nodes in path_deep_compare() order.  Afterwards each
+ * file node's slot is the index of its first master; masters sharing
+ * a name take consecutive slots.  Returns the number of masters.
+ */
+{
+    return order_dir(&root, 0);
+}
+
+/* end */
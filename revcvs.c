@@ -29,138 +29,54 @@
 #include "rbtree.h"
 #endif /* REDBLACK */
 
-#ifdef THREADS
-#include <pthread.h>
-#endif
-
-const master_dir *root_dir = NULL;
-
-static const char *
-fileop_name(const char *rectified)
-{
-    size_t rlen = strlen(rectified);
-
-    if (rlen >= 10 && strcmp(rectified + rlen - 10, ".cvsignore") == 0) {
-        char path[PATH_MAX];
-        strncpy(path, rectified, PATH_MAX-1);
-        path[rlen - 9] = 'g';
-        path[rlen - 8] = 'i';
-        path[rlen - 7] = 't';
-        return atom(path);
-    }
-    // assume rectified is already an atom
-    return rectified;
-}
-
-static const char*
-dir_name(const char *filename)
-{
-    char *slash = strrchr(filename, '/');
-    char buf[PATH_MAX];
-    if (slash) {
-	strncpy(buf, filename, slash - filename);
-	buf[slash - filename] = '\0';
-	return atom(buf);
-    } else {
-	return atom("\0");
-    }
-}
-
-#define DIR_BUCKETS 24593
-
-typedef struct _dir_bucket {
-    struct _dir_bucket *next;
-    master_dir         dir;
-} dir_bucket;
-
-static dir_bucket *dir_buckets[DIR_BUCKETS];
-#ifdef THREADS
-static pthread_mutex_t dir_bucket_mutex;
-
-void atom_dir_init(void)
-{
-    pthread_mutexattr_t attr;
-
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&dir_bucket_mutex, &attr);
-}
-#endif /* THREADS */
-
-static const master_dir *
-atom_dir(const char* dirname)
-/* Extract information about the directory a master is in .
- * atomize the result so all references to the same directory
- * point the the same value.
- * Needs to be called with an atomized string
+/*
+ * The revision index is an open-addressed table of the master's commits
+ * keyed on the address of their interned revision numbers, filled in
+ * as the branches are built.  A number should occur once in a master;
+ * if a damaged one repeats a branch, the first commit built keeps it.
  */
+static void
+cvs_revision_index_add(cvs_file *cvs, cvs_commit *c)
+/* enter a newly built commit in the revision index */
 {
-    dir_bucket **head = &dir_buckets[HASH_VALUE(dirname) % DIR_BUCKETS];
-    dir_bucket *b;
-
-    while ((b = *head)) {
-    collision:
-	if (b->dir.name == dirname)
-	    return &(b->dir);
-	head = &(b->next);
-    }
-#ifdef THREADS
-    if (threads > 1)
-	pthread_mutex_lock(&dir_bucket_mutex);
-#endif /* THREADS */
-    if ((b = *head)) {
-#ifdef THREADS
-	if (threads > 1)
-	    pthread_mutex_unlock(&dir_bucket_mutex);
-#endif /* THREADS */
-	goto collision;
-    }
-    b = xmalloc(sizeof(dir_bucket), __func__);
-    b->next = NULL;
-    b->dir.name = dirname;
-    *head = b;
-    if (strlen(dirname) > 0)
-	/* recursive mutex use, find parent dir */
-	b->dir.parent = atom_dir(dir_name(dirname));
-    else
-	b->dir.parent = NULL;
-#ifdef THREADS
-    if (threads > 1)
-	pthread_mutex_unlock(&dir_bucket_mutex);
-#endif /* THREADS */
-    return &(b->dir);
+    size_t	i;
+
+    for (i = HASH_VALUE(c->number) & cvs->revision_mask;
+	 cvs->revision_index[i];
+	 i = (i + 1) & cvs->revision_mask)
+	if (cvs->revision_index[i]->number == c->number)
+	    return;
+    cvs->revision_index[i] = c;
 }
 
 static cvs_commit *
-cvs_master_find_revision(cvs_master *cm, const cvs_number *number)
-/* given a single-file revlist tree, locate the specific version number */
+cvs_master_find_revision(cvs_file *cvs, const cvs_number *number)
+/* given an interned version number, locate its commit in this master */
 {
-    rev_ref	*h;
     cvs_commit	*c;
+    size_t	i;
 
-    for (h = cm->heads; h; h = h->next) {
-	if (h->tail)
-	    continue;
-	for (c = h->commit; c; c = c->parent)
-	{
-	     if (cvs_number_compare(c->number, number) == 0)
-		    return c;
-	     if (c->tail)
-		 break;
-	}
-    }
+    for (i = HASH_VALUE(number) & cvs->revision_mask;
+	 (c = cvs->revision_index[i]) != NULL;
+	 i = (i + 1) & cvs->revision_mask)
+	if (c->number == number)
+	    return c;
     return NULL;
 }
 
 static rev_master *
 build_rev_master(cvs_file *cvs, rev_master *master)
 {
-    master->name = cvs->export_name;
-    master->fileop_name = fileop_name(cvs->export_name);
-    master->dir = atom_dir(dir_name(master->name));
+    size_t	size = 8;
+
+    /* name, fileop_name and dir come from the path trie, see import.c */
     master->mode = cvs->mode;
-    master->commits = xcalloc(cvs->nversions, sizeof(cvs_commit), "commit slab alloc");
+    master->commits = commit_pool_alloc(cvs->nversions, &master->commit_base);
     master->ncommits = 0;
+    while (size < 2 * (size_t)cvs->nversions)
+	size *= 2;
+    cvs->revision_index = xcalloc(size, sizeof(cvs_commit *), "revision index");
+    cvs->revision_mask = size - 1;
     return master;
 }
 
@@ -204,6 +120,7 @@ cvs_master_branch_build(cvs_file *cvs, rev_master *master, const cvs_number *bra
 	/* leave this around so the branch merging stuff can find numbers */
 	c->master = master;
 	c->number = v->number;
+	cvs_revision_index_add(cvs, c);
 	if (!v->dead) {
 	    node->commit = c;
 	}
@@ -344,6 +261,31 @@ cvs_master_patch_vendor_branch(cvs_master *cm, cvs_file *cvs)
     }
 }
 
+/*
+ * A graft index maps the first revision of each branch, as the
+ * branches phrase of its branch point names it, to the commit at the
+ * branch point, open-addressed on the number's address.  A branch
+ * named by several versions takes the first of them in the version
+ * list that has a commit, as a walk of the version tree would.
+ */
+typedef struct _graft_slot {
+    const cvs_number	*first;
+    cvs_commit		*parent;
+} graft_slot;
+
+static graft_slot *
+graft_index_slot(graft_slot *index, size_t mask, const cvs_number *first)
+/* the slot holding first, or the empty one it would go in */
+{
+    size_t	i;
+
+    for (i = HASH_VALUE(first) & mask;
+	 index[i].first && index[i].first != first;
+	 i = (i + 1) & mask)
+	continue;
+    return &index[i];
+}
+
 static void
 cvs_master_graft_branches(cvs_master *cm, cvs_file *cvs)
 /* turn disconnected branches into a tree by grafting roots to parents */
@@ -352,6 +294,31 @@ cvs_master_graft_branches(cvs_master *cm, cvs_file *cvs)
     cvs_commit	*c;
     cvs_version	*cv;
     cvs_branch	*cb;
+    graft_slot	*index, *slot;
+    size_t	size = 8, nbranches = 0;
+
+    /* only the trunk; it never joins anything */
+    if (!cm->heads || !cm->heads->next)
+	return;
+
+    /*
+     * Index the branch points.  Note that in the presense of vendor
+     * branches, the branch location may actually be out on that
+     * vendor branch.
+     */
+    for (cv = cvs->gen.versions; cv; cv = cv->next)
+	for (cb = cv->branches; cb; cb = cb->next)
+	    nbranches++;
+    while (size < 2 * nbranches)
+	size *= 2;
+    index = xcalloc(size, sizeof(graft_slot), "graft index");
+    for (cv = cvs->gen.versions; cv; cv = cv->next)
+	for (cb = cv->branches; cb; cb = cb->next) {
+	    slot = graft_index_slot(index, size - 1, cb->number);
+	    slot->first = cb->number;
+	    if (!slot->parent)
+		slot->parent = cvs_master_find_revision(cvs, cv->number);
+	}
 
     /*
      * Glue branches together
@@ -376,71 +343,56 @@ cvs_master_graft_branches(cvs_master *cm, cvs_file *cvs)
 		break;
 	    }
 	if (c) {
-	    /*
-	     * Walk the version tree, looking for the branch location.
-	     * Note that in the presense of vendor branches, the
-	     * branch location may actually be out on that vendor branch
-	     */
-	    for (cv = cvs->gen.versions; cv; cv = cv->next) {
-		for (cb = cv->branches; cb; cb = cb->next) {
-		    if (cvs_number_compare(cb->number,
-					    c->number) == 0)
-		    {
-			c->parent = cvs_master_find_revision(cm, cv->number);
-			c->tail = true;
-			break;
-		    }
-		}
-		if (c->parent)
-		{
-#if 0
-		    /*
-		     * check for a parallel vendor branch
-		     */
-		    for (cb = cv->branches; cb; cb = cb->next) {
-			if (cvs_is_vendor(cb->number)) {
-			    cvs_number	v_n;
-			    cvs_commit	*v_c, *n_v_c;
-			    warn("Found merge into vendor branch\n");
-			    memcpy(&v_n, cb->number, sizeof(cvs_number));
-			    v_c = NULL;
-			    /*
-			     * Walk to head of vendor branch
-			     */
-			    while ((n_v_c = cvs_master_find_revision(cm, atom_cve_number(v_n))))
-			    {
-				/*
-				 * Stop if we reach a date after the
-				 * branch version date
-				 */
-				if (time_compare(n_v_c->date, c->date) > 0)
-				    break;
-				v_c = n_v_c;
-				v_n.n[v_n.c - 1]++;
-			    }
-			    if (v_c)
-			    {
-				warn("%s: rewrite branch", cvs->name);
-				dump_number_file(LOGFILE, " branch point",
-						  v_c->number);
-				dump_number_file(LOGFILE, " branch version",
-						  c->number);
-				fprintf(LOGFILE, "\n");
-				c->parent = v_c;
-			    }
-			}
-		    }
-#endif
-		    break;
-		}
+	    slot = graft_index_slot(index, size - 1, c->number);
+	    if (slot->first) {
+		c->parent = slot->parent;
+		c->tail = true;
 	    }
 	}
     }
+    free(index);
+}
+
+/*
+ * A head index maps cvs_branch_key() values to heads, open-addressed
+ * on the key's address.  Several heads can share a branch, and the
+ * first of them in the head list is the one wanted, so a key keeps
+ * the first head entered under it.
+ */
+typedef struct _head_slot {
+    const cvs_number	*key;
+    rev_ref		*head;
+} head_slot;
+
+static head_slot *
+head_index_slot(head_slot *index, size_t mask, const cvs_number *key)
+/* the slot holding key, or the empty one it would go in */
+{
+    size_t	i;
+
+    for (i = HASH_VALUE(key) & mask;
+	 index[i].key && index[i].key != key;
+	 i = (i + 1) & mask)
+	continue;
+    return &index[i];
+}
+
+static void
+head_index_add(head_slot *index, size_t mask, const cvs_number *number, rev_ref *h)
+/* file a head under the branch of number, unless one is there already */
+{
+    const cvs_number	*key = cvs_branch_key(number);
+    head_slot		*slot = head_index_slot(index, mask, key);
+
+    if (!slot->key) {
+	slot->key = key;
+	slot->head = h;
+    }
 }
 
 static rev_ref *
-cvs_master_find_branch(cvs_master *cm, const cvs_number *number)
-/* look up a revision reference in a revlist by symbol */
+cvs_master_find_branch(head_slot *index, size_t mask, const cvs_number *number)
+/* look up a revision reference in a head index by number */
 {
     cvs_number	n;
     rev_ref	*h;
@@ -450,12 +402,7 @@ cvs_master_find_branch(cvs_master *cm, const cvs_number *number)
     memcpy(&n, number, sizeof(cvs_number));
     h = NULL;
     while (n.c >= 2) {
-	const cvs_number *k = atom_cvs_number(n);
-	for (h = cm->heads; h; h = h->next) {
-	    if (cvs_same_branch(h->number, k)) {
-		break;
-	    }
-	}
+	h = head_index_slot(index, mask, cvs_branch_key(&n))->head;
 	if (h)
 	    break;
 	n.c -= 2;
@@ -467,44 +414,59 @@ static void
 cvs_master_set_refs(cvs_master *cm, cvs_file *cvsfile)
 /* create head references or tags for each symbol in the CVS master */
 {
-    rev_ref	*h, **ph, *h2;
+    rev_ref	*h, **ph, *h2, **tail;
     cvs_symbol	*s;
-   
+    head_slot	*index;
+    size_t	size = 8, nheads = 0;
+
+    /* room for the heads there are and one per branch symbol */
+    for (tail = &cm->heads; *tail; tail = &(*tail)->next)
+	nheads++;
+    for (s = cvsfile->symbols; s; s = s->next)
+	if (cvs_is_head(s->number))
+	    nheads++;
+    while (size < 2 * nheads)
+	size *= 2;
+    index = xcalloc(size, sizeof(head_slot), "head index");
+
+    /* branch symbols find their heads by the branch of the head's tip */
+    for (h = cm->heads; h; h = h->next)
+	if (h->commit)
+	    head_index_add(index, size - 1, h->commit->number, h);
     for (s = cvsfile->symbols; s; s = s->next) {
 	cvs_commit	*c = NULL;
 	/*
 	 * Locate a symbolic name for this head
 	 */
 	if (cvs_is_head(s->number)) {
-	    for (h = cm->heads; h; h = h->next) {
-		if (cvs_same_branch(h->commit->number, s->number))
-		    break;
-	    }
+	    h = head_index_slot(index, size - 1, cvs_branch_key(s->number))->head;
 	    if (h) {
 		if (!h->ref_name) {
 		    h->ref_name = s->symbol_name;
 		    h->degree = cvs_number_degree(s->number);
 		} else
-		    h = rev_list_add_head(cm, h->commit, s->symbol_name,
-					   cvs_number_degree(s->number));
+		    h = rev_list_append_head(&tail, h->commit, s->symbol_name,
+					     cvs_number_degree(s->number));
 	    } else {
 		cvs_number n;
 
 		memcpy(&n, s->number, sizeof(cvs_number));
 		while (n.c >= 4) {
 		    n.c -= 2;
-		    c = cvs_master_find_revision(cm, atom_cvs_number(n));
+		    c = cvs_master_find_revision(cvsfile, atom_cvs_number(n));
 		    if (c)
 			break;
 		}
-		if (c)
-		    h = rev_list_add_head(cm, c, s->symbol_name,
-					   cvs_number_degree(s->number));
+		if (c) {
+		    h = rev_list_append_head(&tail, c, s->symbol_name,
+					     cvs_number_degree(s->number));
+		    head_index_add(index, size - 1, c->number, h);
+		}
 	    }
 	    if (h)
 		h->number = s->number;
 	} else {
-	    c = cvs_master_find_revision(cm, s->number);
+	    c = cvs_master_find_revision(cvsfile, s->number);
 	    if (c)
 		tag_commit(c, s->symbol_name, cvsfile);
 	}
@@ -562,8 +524,12 @@ cvs_master_set_refs(cvs_master *cm, cvs_file *cvsfile)
     }
 
     /*
-     * Link heads together in a tree
+     * Link heads together in a tree; parents are found by head number
      */
+    memset(index, 0, size * sizeof(head_slot));
+    for (h = cm->heads; h; h = h->next)
+	if (h->number)
+	    head_index_add(index, size - 1, h->number, h);
     for (h = cm->heads; h; h = h->next) {
 	cvs_number	n;
 
@@ -590,7 +556,7 @@ cvs_master_set_refs(cvs_master *cm, cvs_file *cvsfile)
 	if (h->number->c >= 4) {
 	    memcpy(&n, h->number, sizeof(cvs_number));
 	    n.c -= 2;
-	    h->parent = cvs_master_find_branch(cm, atom_cvs_number(n));
+	    h->parent = cvs_master_find_branch(index, size - 1, &n);
 	    if (!h->parent && !cvs_is_vendor(h->number))
 		warn("warning - non-vendor %s branch %s has no parent\n",
 			 cvsfile->gen.master_name, h->ref_name);
@@ -610,9 +576,39 @@ cvs_master_set_refs(cvs_master *cm, cvs_file *cvsfile)
 	    h->ref_name = atom(name);
 	}
     }
+    free(index);
 }
 
-#ifdef REDBLACK
+#if defined(SYMINDEX)
+/*
+ * The symbol index is an open-addressed table of the master's symbols
+ * keyed on the address of the name atom: one allocation per master,
+ * two slots per symbol or more, and a lookup usually touches one slot.
+ */
+static void
+cvs_symbol_index(cvs_file *cvs)
+/* build the index cvs_find_symbol() uses */
+{
+    cvs_symbol	*s;
+    size_t	n = 0, size = 8, i;
+
+    for (s = cvs->symbols; s; s = s->next)
+	n++;
+    while (size < 2 * n)
+	size *= 2;
+    cvs->symbol_index = xcalloc(size, sizeof(cvs_symbol *), "symbol index");
+    cvs->symbol_mask = size - 1;
+    for (s = cvs->symbols; s; s = s->next) {
+	for (i = HASH_VALUE(s->symbol_name) & cvs->symbol_mask;
+	     cvs->symbol_index[i];
+	     i = (i + 1) & cvs->symbol_mask)
+	    if (cvs->symbol_index[i]->symbol_name == s->symbol_name)
+		fatal_error("internal error - duplicate symbol %s in %s",
+			    s->symbol_name, cvs->gen.master_name);
+	cvs->symbol_index[i] = s;
+    }
+}
+#elif defined(REDBLACK)
 static int
 cvs_symbol_name_compare(const void *x, const void *y)
 /* compare function used for red-black tree lookup */
@@ -624,13 +620,22 @@ cvs_symbol_name_compare(const void *x, const void *y)
     else
 	return 0;
 }
-#endif /* REDBLACK */
+#endif /* SYMINDEX */
 
 static cvs_symbol *
 cvs_find_symbol(cvs_file *cvs, const char *name)
 /* return the CVS symbol corresponding to a specified name */
 {
-#ifdef REDBLACK
+#if defined(SYMINDEX)
+    cvs_symbol *s;
+    size_t i;
+
+    for (i = HASH_VALUE(name) & cvs->symbol_mask;
+	 (s = cvs->symbol_index[i]) != NULL;
+	 i = (i + 1) & cvs->symbol_mask)
+	if (s->symbol_name == name)
+	    return s;
+#elif defined(REDBLACK)
     struct rbtree_node *n, **tree;
 
     tree = &cvs->symbols_by_name;
@@ -649,7 +654,7 @@ cvs_find_symbol(cvs_file *cvs, const char *name)
     for (s = cvs->symbols; s; s = s->next)
 	if (s->symbol_name == name)
 	    return s;
-#endif /*  REDBLACK */
+#endif /* SYMINDEX */
     return NULL;
 }
 
@@ -765,6 +770,19 @@ cvs_master_sort_heads(cvs_master *cm, cvs_file *cvs)
 #endif /* CVSDEBUG */
 }
 
+static void
+digest_lap(cvs_file *cvs, enum digest_phase phase, struct timespec *mark)
+/* under -p, charge the time since *mark to a phase of the digest */
+{
+    struct timespec now;
+
+    if (!progress)
+	return;
+    clock_gettime(CLOCK_REALTIME, &now);
+    cvs->digest.seconds[phase] += seconds_diff(&now, mark);
+    *mark = now;
+}
+
 void
 cvs_master_digest(cvs_file *cvs, cvs_master *cm, rev_master *master)
 /* fill out a linked list capturing the CVS master file structure */
@@ -775,14 +793,20 @@ cvs_master_digest(cvs_file *cvs, cvs_master *cm, rev_master *master)
     cvs_version	*cv;
     cvs_branch	*cb;
     cvs_version	*ctrunk = NULL;
+    rev_ref	**tail;
+    struct timespec mark;
 
-    if (!root_dir) root_dir = atom_dir(atom("\0"));
+    if (progress)
+	clock_gettime(CLOCK_REALTIME, &mark);
+    for (tail = &cm->heads; *tail; tail = &(*tail)->next)
+	continue;
     build_rev_master(cvs, master);
 #if CVSDEBUG
     char buf[CVS_MAX_REV_LEN];
 #endif /* CVSDEBUG */
 
     build_branches(&cvs->gen.nodehash);
+    cvs_version_index(cvs);
     /*
      * Locate first revision on trunk branch
      */
@@ -803,7 +827,7 @@ cvs_master_digest(cvs_file *cvs, cvs_master *cm, rev_master *master)
     trunk = cvs_master_branch_build(cvs, master, trunk_number);
     if (trunk) {
 	rev_ref	*t;
-	t = rev_list_add_head(cm, trunk, atom("master"), 2);
+	t = rev_list_append_head(&tail, trunk, atom("master"), 2);
 	t->number = trunk_number;
 #if CVSDEBUG
 	if (cvs->verbose > 0)
@@ -837,14 +861,35 @@ w    /*
 			 cvs_number_string(branch->number, buf3, CVS_MAX_REV_LEN));
 	    }
 #endif /* CVSDEBUG */
-	    rev_list_add_head(cm, branch, NULL, 0);
+	    rev_list_append_head(&tail, branch, NULL, 0);
 	}
     }
+    digest_lap(cvs, digest_build, &mark);
     cvs_master_patch_vendor_branch(cm, cvs);
+    digest_lap(cvs, digest_vendor, &mark);
     cvs_master_graft_branches(cm, cvs);
+    digest_lap(cvs, digest_graft, &mark);
     cvs_master_set_refs(cm, cvs);
+    digest_lap(cvs, digest_refs, &mark);
+#ifdef SYMINDEX
+    /* symbols are only looked up to order multiple heads */
+    if (cm->heads && cm->heads->next)
+	cvs_symbol_index(cvs);
+#endif /* SYMINDEX */
     cvs_master_sort_heads(cm, cvs);
+    digest_lap(cvs, digest_sort, &mark);
     rev_list_set_tail(cm);
+    digest_lap(cvs, digest_tail, &mark);
+    if (progress) {
+	rev_ref		*h;
+	cvs_symbol	*s;
+
+	cvs->digest.nversions = cvs->nversions;
+	for (h = cm->heads; h; h = h->next)
+	    cvs->digest.nheads++;
+	for (s = cvs->symbols; s; s = s->next)
+	    cvs->digest.nsymbols++;
+    }
 
 #ifdef CVSDEBUG
     if (cvs->verbose > 0) {
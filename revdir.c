@@ -20,6 +20,8 @@
  * which directories are coalesced.
  */
 
+#include <stddef.h>
+
 #include "cvs.h"
 #include "hash.h"
 #include "revdir.h"
@@ -34,6 +36,40 @@ dir_is_ancestor(const master_dir *child, const master_dir *ancestor)
     return false;
 }
 
+/* pack numbering while a checkpoint is written or read */
+static void	**checkpoint_packs;
+static serial_t	checkpoint_npacks;
+
+static int
+compare_address(const void *a, const void *b)
+/* order pack pointers by address, for binary search */
+{
+    const void *x = *(void * const *)a, *y = *(void * const *)b;
+
+    if (x < y)
+	return -1;
+    return x > y;
+}
+
+static serial_t
+checkpoint_pack_index(const void *pack)
+/* map a pack pointer to its number in the checkpoint */
+{
+    void **hit = bsearch(&pack, checkpoint_packs, checkpoint_npacks,
+			 sizeof(void *), compare_address);
+    if (hit == NULL)
+	fatal_error("internal error - pack missing while checkpointing");
+    return (serial_t)(hit - checkpoint_packs);
+}
+
+void
+revdir_checkpoint_done(void)
+{
+    free(checkpoint_packs);
+    checkpoint_packs = NULL;
+    checkpoint_npacks = 0;
+}
+
 #ifdef TREEPACK
 #include "treepack.c"
 #else
@@ -24,7 +24,7 @@ void
 revdir_pack_init(void);
 
 void
-revdir_pack_add(const cvs_commit *file, const master_dir *dir);
+revdir_pack_add(const commit_handle file, const master_dir *dir);
 
 void
 revdir_pack_end(revdir *revdir);
@@ -58,6 +58,26 @@ revdir_free_bufs(void);
 void
 revdir_free(void);
 
+/* checkpoint support: write every pack, numbering them for revdir_save() */
+void
+revdir_save_packs(serial_t (*file_index)(const cvs_commit *));
+
+/* write a revdir as a reference to a saved pack */
+void
+revdir_save(const revdir *revdir);
+
+/* rebuild the packs written by revdir_save_packs() */
+void
+revdir_load_packs(cvs_commit *(*file_at)(serial_t));
+
+/* read a revdir written by revdir_save() */
+void
+revdir_load(revdir *revdir);
+
+/* release the pack numbering used while saving or loading */
+void
+revdir_checkpoint_done(void);
+
 /* useful if you're reusing an iterator with different revdirs */
 #define REVDIR_ITER_START(iter, revdir) \
     if (!(iter))				    \
@@ -25,52 +25,97 @@
  */
 
 rev_ref *
-rev_list_add_head(head_list *rl, cvs_commit *commit, 
-		  const char *name, const int degree)
-/* decorate a commit list with a named head reference */
+rev_list_append_head(rev_ref ***tail, cvs_commit *commit, 
+		     const char *name, const int degree)
+/* add a head reference at *tail, the end of a head list, and advance it */
 {
     rev_ref	*r;
-    rev_ref	**list = &rl->heads;
 
-    while (*list)
-	list = &(*list)->next;
     r = xcalloc(1, sizeof(rev_ref), "adding head reference");
     r->commit = commit;
     r->ref_name = name;
-    r->next = *list;
+    r->next = **tail;
     r->degree = degree;
-    *list = r;
+    **tail = r;
+    *tail = &r->next;
     return r;
 }
 
+rev_ref *
+rev_list_add_head(head_list *rl, cvs_commit *commit, 
+		  const char *name, const int degree)
+/* decorate a commit list with a named head reference */
+{
+    rev_ref	**list = &rl->heads;
+
+    while (*list)
+	list = &(*list)->next;
+    return rev_list_append_head(&list, commit, name, degree);
+}
+
 void
 rev_list_set_tail(head_list *rl)
 /* set tail bits so we can walk through each commit in a revlist exactly once */
 {
     rev_ref	*head;
-    cvs_commit	*c;
+    cvs_commit	*c, **first, **last;
+    size_t	nheads = 0, i;
 
     /* 
      * Set tail bit true where traversal should stop in order to avoid
-     * multiple visits to the same commit.
+     * multiple visits to the same commit: on a head reference whose
+     * commit an earlier head reached, else on the child of the first
+     * join commit on the branch.
+     *
+     * A commit's refcount is the number of heads whose ancestry holds
+     * it.  Rather than walk every head back to the root, each walk
+     * stops at its join and leaves a count there; the counts are then
+     * carried rootwards, last walk first, so every commit has had its
+     * children's counts added before it passes its own on.  While the
+     * walks go on, a nonzero refcount just means "visited".
      */ 
-    for (head = rl->heads; head; head = head->next) {
-	flag tail = true;
-	/* set tail on each previously visited head reference */
-	if (head->commit && head->commit->refcount > 0) {
-	    head->tail = tail;
-	    tail = false;
+    for (head = rl->heads; head; head = head->next)
+	nheads++;
+    first = xmalloc(2 * nheads * sizeof(cvs_commit *), "setting tails");
+    last = first + nheads;
+    for (head = rl->heads, i = 0; head; head = head->next, i++) {
+	first[i] = last[i] = NULL;
+	if (!head->commit)
+	    continue;
+	if (head->commit->refcount > 0) {
+	    head->tail = true;
+	    c = head->commit;
+	} else {
+	    first[i] = head->commit;
+	    for (c = head->commit; c; c = c->parent) {
+		c->refcount = 1;
+		last[i] = c;
+		if (c->parent && c->parent->refcount > 0) {
+		    c->tail = true;
+		    break;
+		}
+	    }
+	    if (!c)
+		continue;
+	    c = c->parent;
 	}
-	for (c = head->commit; c; c = c->parent) {
-	    /* set tail on the child of the first join commit on this branch */
-	    if (tail && c->parent && c->refcount < c->parent->refcount) {
-		c->tail = true;
-		tail = false;
+	if (c->refcount++ >= MAX_BRANCHCOUNT_T)
+	    fatal_error("too many branches, widen branchcount_t");
+    }
+    for (i = nheads; i-- > 0; ) {
+	if (!first[i])
+	    continue;
+	for (c = first[i]; ; c = c->parent) {
+	    if (c->parent) {
+		if ((size_t)c->parent->refcount + c->refcount - 1 > MAX_BRANCHCOUNT_T)
+		    fatal_error("too many branches, widen branchcount_t");
+		c->parent->refcount += c->refcount - 1;
 	    }
-	    if (c->refcount++ >= MAX_BRANCHCOUNT_T)
-		fatal_error("too many branches, widen branchcount_t");
+	    if (c == last[i])
+		break;
 	}
     }
+    free(first);
 }
 
 #ifdef __UNUSED__
@@ -1,11 +1,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
-#ifdef THREADS
-#include <pthread.h>
-#endif /* THREADS */
 
 #include "cvs.h"
+#include "hash.h"
 
 /*
  * Manage objects that represent gitspace lightweight tags.
@@ -14,32 +12,43 @@
  * the tag table should *not* be local to any one master.  
  */
 
-static tag_t *table[4096];
+static tag_t **table;
+static size_t table_size;
 
 tag_t  *all_tags;
 size_t tag_count = 0;
 
-#ifdef THREADS
-static pthread_mutex_t tag_mutex = PTHREAD_MUTEX_INITIALIZER;
-#endif /* THREADS */
+#define tag_hash(name) (HASH_VALUE(name) & (table_size - 1))
 
-static int tag_hash(const char *name)
-/* return the hash code for a specified tag */ 
+static void grow_table(void)
+/* double the hash table, keeping about one tag per bucket */
 {
-    uintptr_t l = (uintptr_t)name;
-    int res = 0;
-    while (l) {
-	res ^= l;
-	l >>= 12;
+    size_t old_size = table_size, i;
+    tag_t **old = table;
+
+    table_size = old_size ? old_size * 2 : 1024;
+    table = xcalloc(table_size, sizeof(tag_t *), "tag lookup");
+    for (i = 0; i < old_size; i++) {
+	tag_t *tag, *next;
+	for (tag = old[i]; tag; tag = next) {
+	    size_t hash = tag_hash(tag->name);
+	    next = tag->hash_next;
+	    tag->hash_next = table[hash];
+	    table[hash] = tag;
+	}
     }
-    return res & 4095;
+    free(old);
 }
 
 static tag_t *find_tag(const char *name)
 /* look up a tag by name */
 {
-    int hash = tag_hash(name);
+    size_t hash;
     tag_t *tag;
+
+    if (tag_count >= table_size)
+	grow_table();
+    hash = tag_hash(name);
     for (tag = table[hash]; tag; tag = tag->hash_next)
 	if (tag->name == name)
 	    return tag;
@@ -53,20 +62,15 @@ static tag_t *find_tag(const char *name)
     return tag;
 }
 
-void tag_commit(cvs_commit *c, const char *name, cvs_file *cvsfile)
-/* add a CVS commit to the list associated with a named tag */
+static void add_tag(cvs_commit *c, const char *name, const char *master_name)
+/* add a CVS commit to a named tag */
 {
-    tag_t *tag;
-#ifdef THREADS
-    if (threads > 1)
-	pthread_mutex_lock(&tag_mutex);
-#endif /* THREADS */
-    tag = find_tag(name);
-    if (tag->last == cvsfile->gen.master_name) {
+    tag_t *tag = find_tag(name);
+    if (tag->last == master_name) {
 	announce("duplicate tag %s in CVS master %s, ignoring\n",
-		 name, cvsfile->gen.master_name);
+		 name, master_name);
     } else {
-	tag->last = cvsfile->gen.master_name;
+	tag->last = master_name;
 	if (!tag->left) {
 	    chunk_t *v = xmalloc(sizeof(chunk_t), __func__);
 	    v->next = tag->commits;
@@ -76,10 +80,38 @@ void tag_commit(cvs_commit *c, const char *name, cvs_file *cvsfile)
 	tag->commits->v[--tag->left] = c;
 	tag->count++;
     }
-#ifdef THREADS
-    if (threads > 1)
-	pthread_mutex_unlock(&tag_mutex);
-#endif /* THREADS */
+}
+
+/*
+ * The order of the tag list, and of the commits on each tag, follows
+ * the order tags are filed in, and shows in the output.  Workers digest
+ * masters in no fixed order, so each stages its tags in a buffer of its
+ * own, without locking, and once parsing is over the caller replays
+ * them master by master in the final master order.
+ */
+void tag_commit(cvs_commit *c, const char *name, cvs_file *cvsfile)
+/* stage a CVS commit for the list associated with a named tag */
+{
+    tag_stage *stage = cvsfile->tag_stage;
+
+    if (stage->count == stage->alloc) {
+	stage->alloc = stage->alloc ? stage->alloc * 2 : 256;
+	stage->tags = xrealloc(stage->tags,
+			       stage->alloc * sizeof(staged_tag), "tag staging");
+    }
+    stage->tags[stage->count].commit = c;
+    stage->tags[stage->count].name = name;
+    stage->count++;
+}
+
+void tag_replay(const tag_stage *stage, size_t first, size_t count,
+		const char *master_name)
+/* file a master's staged tags, in the order they were staged */
+{
+    const staged_tag *st;
+
+    for (st = stage->tags + first; st < stage->tags + first + count; st++)
+	add_tag(st->commit, st->name, master_name);
 }
 
 cvs_commit **tagged(tag_t *tag)
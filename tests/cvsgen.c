@@ -0,0 +1,869 @@
+/*
+ * cvsgen - write a synthetic CVS repository for benchmarking
+ *
+ * Generates a tree of RCS masters with a plausible history: a global
+ * sequence of commits, each touching a handful of files on the trunk or
+ * on one of the branches, interleaved with branch creation, tags and
+ * (optionally) vendor imports.  The shape of the history is controlled
+ * by command-line switches so the same generator can produce wide,
+ * deep, branchy or skewed corpora for the bench target in the Makefile.
+ *
+ * The output is deterministic for a given seed and set of switches.
+ * Every revision is a single contiguous hunk edit of its predecessor,
+ * so the deltatexts are short and realistic rather than full rewrites.
+ *
+ * This is deliberately standalone; it does not use cvs.h.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAXDEPTH	8	/* revision number components */
+#define EPOCH		946684800	/* 2000-01-01 00:00:00 UTC */
+
+typedef struct {
+    int n;
+    unsigned short d[MAXDEPTH];
+} revnum;
+
+enum event_kind { EV_COMMIT, EV_BRANCH, EV_TAG, EV_IMPORT };
+
+typedef struct {
+    enum event_kind kind;
+    time_t date;
+    int branch;		/* 0 for trunk, else 1-origin branch */
+    int index;		/* branch, tag or import ordinal */
+    int author;
+    bool commitid;
+    unsigned first, count;	/* slice of event_files */
+} event;
+
+typedef struct {
+    revnum num;
+    time_t date;
+    unsigned event;
+    int author;
+    bool dead;
+    bool has_commitid;
+    const char *log;
+    unsigned *lines;
+    unsigned nlines;
+    int parent;		/* delta this one's text was derived from */
+    int next;		/* RCS next: older on trunk, newer on branches */
+    int *branches;	/* first revisions of branches sprouting here */
+    int nbranches;
+    int nsprouts;	/* branch numbers allocated at this delta */
+} delta;
+
+typedef struct {
+    bool exists;
+    int point;		/* delta the branch sprouts from */
+    revnum number;	/* branch number, e.g. 1.3.2 */
+    int head;		/* last delta on the branch, or -1 */
+} file_branch;
+
+typedef struct {
+    char *name;
+    revnum num;
+    bool branch;
+} symbol;
+
+static const char *authors[] = {
+    "alice", "bob", "carol", "dave", "eve", "frank", "grace", "heidi",
+    "ivan", "judy", "mallory", "oscar", "peggy", "trent", "victor", "walter",
+};
+#define NAUTHORS	(sizeof(authors) / sizeof(authors[0]))
+
+static const char *subsystems[] = {
+    "parser", "lexer", "export", "import", "merge", "tags", "docs", "build",
+};
+#define NSUBSYSTEMS	(sizeof(subsystems) / sizeof(subsystems[0]))
+
+/* switches */
+static unsigned nfiles = 100;
+static unsigned ncommits = 1000;
+static unsigned width = 4;
+static unsigned nbranches = 3;
+static unsigned ntags = 10;
+static unsigned nimports = 0;
+static unsigned nlines = 40;
+static unsigned commitid_pct = 50;
+static unsigned skew_pct = 0;
+static unsigned skew_max = 300;
+static unsigned dead_pct = 2;
+static unsigned ndirs = 0;
+static unsigned long seed = 1;
+
+/* global history plan */
+static event *events;
+static unsigned nevents;
+static unsigned *event_files;
+static unsigned *birth;			/* event at which each file appears */
+static unsigned *file_first, *file_count, *file_events;	/* per-file events */
+static unsigned *global_events;		/* branch and tag events */
+static unsigned nglobal;
+
+static const char *progname = "cvsgen";
+
+static void
+fatal(const char *fmt, ...)
+/* complain and die */
+{
+    va_list ap;
+
+    fprintf(stderr, "%s: ", progname);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static void *
+xmalloc(size_t size)
+/* malloc or die */
+{
+    void *p = malloc(size ? size : 1);
+
+    if (p == NULL)
+	fatal("out of memory");
+    return p;
+}
+
+static void *
+xrealloc(void *p, size_t size)
+/* realloc or die */
+{
+    p = realloc(p, size ? size : 1);
+    if (p == NULL)
+	fatal("out of memory");
+    return p;
+}
+
+static uint64_t
+rng_next(uint64_t *state)
+/* xorshift64* step */
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static void
+rng_seed(uint64_t *state, uint64_t a, uint64_t b)
+/* derive an independent stream from the seed and a discriminator */
+{
+    uint64_t x = a * 0x9E3779B97F4A7C15ULL + b + 1;
+
+    x ^= x >> 31;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    *state = x ? x : 1;
+}
+
+static unsigned
+rng_below(uint64_t *state, unsigned n)
+/* uniform integer in [0, n) */
+{
+    return n ? (unsigned)(rng_next(state) % n) : 0;
+}
+
+static bool
+rng_pct(uint64_t *state, unsigned pct)
+/* true pct percent of the time */
+{
+    return rng_below(state, 100) < pct;
+}
+
+static void
+plan_history(void)
+/* lay out the global sequence of events and the files each one touches */
+{
+    uint64_t rng;
+    unsigned *born, nborn = 0, nvendor, nadded = 0, i, e, c, b, t, v;
+    unsigned *slots, nslots, cap;
+    int *kinds;
+    time_t date = EPOCH;
+
+    rng_seed(&rng, seed, 0);
+    nevents = ncommits + nbranches + ntags + nimports;
+    events = xmalloc(sizeof(event) * nevents);
+    birth = xmalloc(sizeof(unsigned) * nfiles);
+    born = xmalloc(sizeof(unsigned) * nfiles);
+
+    /*
+     * Imports come first, like a project starting from a vendor drop;
+     * branches and tags are scattered over the commits that follow.
+     */
+    kinds = xmalloc(sizeof(int) * nevents);
+    for (i = 0; i < nimports; i++)
+	kinds[i] = EV_IMPORT;
+    for (; i < nevents; i++)
+	kinds[i] = EV_COMMIT;
+    for (i = 0; i < nbranches + ntags; i++) {
+	do
+	    e = nimports + 1 + rng_below(&rng, nevents - nimports - 1);
+	while (kinds[e] != EV_COMMIT);
+	kinds[e] = i < nbranches ? EV_BRANCH : EV_TAG;
+    }
+
+    /* a quarter of the files come from the vendor, the rest are added on trunk */
+    nvendor = nimports ? nfiles / 4 + 1 : 0;
+    if (nvendor > nfiles)
+	nvendor = nfiles;
+    for (i = 0; i < nfiles; i++)
+	birth[i] = UINT_MAX;
+
+    cap = (ncommits * width * 2) + nfiles + 16;
+    event_files = xmalloc(sizeof(unsigned) * cap);
+    nslots = 0;
+    slots = event_files;
+
+    c = b = t = v = 0;
+    for (e = 0; e < nevents; e++) {
+	event *ev = &events[e];
+	unsigned want, k;
+
+	if (nslots + nfiles + 2 * width >= cap) {
+	    cap = cap * 2 + nfiles + 2 * width;
+	    event_files = slots = xrealloc(slots, sizeof(unsigned) * cap);
+	}
+	date += 1 + rng_below(&rng, 600);
+	ev->kind = kinds[e];
+	ev->date = date;
+	ev->author = rng_below(&rng, NAUTHORS);
+	ev->branch = 0;
+	ev->commitid = false;
+	ev->first = nslots;
+	ev->count = 0;
+
+	switch (ev->kind) {
+	case EV_IMPORT:
+	    ev->index = v;
+	    if (v++ == 0) {
+		/* the first drop creates every vendor file */
+		for (i = 0; i < nvendor; i++) {
+		    birth[i] = e;
+		    born[nborn++] = i;
+		    slots[nslots++] = i;
+		}
+	    } else {
+		for (i = 0; i < nvendor; i++)
+		    if (rng_pct(&rng, 50))
+			slots[nslots++] = i;
+	    }
+	    break;
+	case EV_BRANCH:
+	    ev->index = ++b;
+	    break;
+	case EV_TAG:
+	    ev->index = t++;
+	    ev->branch = (b > 0 && rng_pct(&rng, 30)) ? 1 + rng_below(&rng, b) : 0;
+	    break;
+	case EV_COMMIT:
+	    ev->index = c++;
+	    ev->commitid = rng_pct(&rng, commitid_pct);
+	    ev->branch = (b > 0 && rng_pct(&rng, 35)) ? 1 + rng_below(&rng, b) : 0;
+	    /* files are added on trunk over the first half of the commits */
+	    if (ev->branch == 0) {
+		uint64_t quota = ((uint64_t)c * (nfiles - nvendor) * 2 + ncommits - 1) / ncommits;
+		while (nadded < quota && nadded < nfiles - nvendor) {
+		    i = nvendor + nadded++;
+		    birth[i] = e;
+		    born[nborn++] = i;
+		    slots[nslots++] = i;
+		}
+	    }
+	    if (nborn == 0)
+		break;
+	    want = 1 + rng_below(&rng, 2 * width - 1);
+	    for (k = 0; k < want; k++) {
+		unsigned f = born[rng_below(&rng, nborn)], j;
+		bool dup = false;
+		for (j = ev->first; j < nslots; j++)
+		    if (slots[j] == f)
+			dup = true;
+		if (!dup)
+		    slots[nslots++] = f;
+	    }
+	    break;
+	}
+	ev->count = nslots - ev->first;
+    }
+    free(kinds);
+    free(born);
+
+    /* invert the event-to-file map */
+    file_first = xmalloc(sizeof(unsigned) * (nfiles + 1));
+    file_count = xmalloc(sizeof(unsigned) * nfiles);
+    memset(file_count, 0, sizeof(unsigned) * nfiles);
+    for (i = 0; i < nslots; i++)
+	file_count[event_files[i]]++;
+    file_first[0] = 0;
+    for (i = 0; i < nfiles; i++)
+	file_first[i + 1] = file_first[i] + file_count[i];
+    file_events = xmalloc(sizeof(unsigned) * (nslots + 1));
+    memset(file_count, 0, sizeof(unsigned) * nfiles);
+    for (e = 0; e < nevents; e++)
+	for (i = events[e].first; i < events[e].first + events[e].count; i++) {
+	    unsigned f = event_files[i];
+	    file_events[file_first[f] + file_count[f]++] = e;
+	}
+
+    global_events = xmalloc(sizeof(unsigned) * (nbranches + ntags + 1));
+    nglobal = 0;
+    for (e = 0; e < nevents; e++)
+	if (events[e].kind == EV_BRANCH || events[e].kind == EV_TAG)
+	    global_events[nglobal++] = e;
+}
+
+/*
+ * Per-file generation
+ */
+
+static delta *deltas;
+static int ndeltas, maxdeltas;
+static symbol *symbols;
+static int nsymbols, maxsymbols;
+static file_branch *branches;
+static unsigned next_line;
+
+static char *
+revstr(const revnum *r, char *buf)
+/* format a revision number */
+{
+    char *p = buf;
+    int i;
+
+    for (i = 0; i < r->n; i++)
+	p += sprintf(p, i ? ".%u" : "%u", r->d[i]);
+    return buf;
+}
+
+static revnum
+revchild(const revnum *r, unsigned a, unsigned b)
+/* extend a revision number by up to two components */
+{
+    revnum n = *r;
+
+    if (n.n + 2 > MAXDEPTH)
+	fatal("revision numbers too deep; use fewer branches");
+    n.d[n.n++] = a;
+    if (b)
+	n.d[n.n++] = b;
+    return n;
+}
+
+static int
+new_delta(int parent, const revnum *num, const event *ev, unsigned e, const char *log)
+/* allocate a delta whose text starts as a copy of its parent's */
+{
+    delta *d;
+
+    if (ndeltas == maxdeltas) {
+	maxdeltas = maxdeltas ? maxdeltas * 2 : 64;
+	deltas = xrealloc(deltas, sizeof(delta) * maxdeltas);
+    }
+    d = &deltas[ndeltas];
+    memset(d, 0, sizeof(*d));
+    d->num = *num;
+    d->date = ev->date;
+    d->event = e;
+    d->author = ev->author;
+    d->has_commitid = ev->commitid;
+    d->log = log;
+    d->parent = parent;
+    d->next = -1;
+    if (parent >= 0) {
+	d->nlines = deltas[parent].nlines;
+	d->lines = xmalloc(sizeof(unsigned) * (d->nlines + 8));
+	memcpy(d->lines, deltas[parent].lines, sizeof(unsigned) * d->nlines);
+    } else {
+	unsigned i;
+	d->nlines = nlines ? nlines : 1;
+	d->lines = xmalloc(sizeof(unsigned) * (d->nlines + 8));
+	for (i = 0; i < d->nlines; i++)
+	    d->lines[i] = next_line++;
+    }
+    return ndeltas++;
+}
+
+static void
+edit_delta(int n, uint64_t *rng)
+/* replace a short run of lines in a delta's text */
+{
+    delta *d = &deltas[n];
+    unsigned at, del, add, i;
+
+    at = rng_below(rng, d->nlines + 1);
+    del = rng_below(rng, 4);
+    if (del > d->nlines - at)
+	del = d->nlines - at;
+    add = rng_below(rng, 5);
+    if (del == 0 && add == 0)
+	add = 1;
+    if (d->nlines - del + add == 0)
+	add = 1;
+    d->lines = xrealloc(d->lines, sizeof(unsigned) * (d->nlines + add + 1));
+    memmove(d->lines + at + add, d->lines + at + del,
+	    sizeof(unsigned) * (d->nlines - at - del));
+    for (i = 0; i < add; i++)
+	d->lines[at + i] = next_line++;
+    d->nlines = d->nlines - del + add;
+}
+
+static void
+skew_delta(int n, uint64_t *rng)
+/* jitter a delta's date, keeping it after its predecessor */
+{
+    delta *d = &deltas[n];
+    time_t floor;
+
+    if (skew_pct && rng_pct(rng, skew_pct))
+	d->date += (time_t)rng_below(rng, 2 * skew_max + 1) - (time_t)skew_max;
+    floor = d->parent >= 0 ? deltas[d->parent].date + 1 : EPOCH;
+    if (d->date < floor)
+	d->date = floor;
+}
+
+static void
+add_sprout(int point, int first)
+/* record a branch's first revision on the delta it sprouts from */
+{
+    delta *d = &deltas[point];
+
+    d->branches = xrealloc(d->branches, sizeof(int) * (d->nbranches + 1));
+    d->branches[d->nbranches++] = first;
+}
+
+static void
+add_symbol(const char *name, const revnum *num, bool branch)
+/* attach a symbolic name to a revision or branch */
+{
+    if (nsymbols == maxsymbols) {
+	maxsymbols = maxsymbols ? maxsymbols * 2 : 16;
+	symbols = xrealloc(symbols, sizeof(symbol) * maxsymbols);
+    }
+    symbols[nsymbols].name = strdup(name);
+    symbols[nsymbols].num = *num;
+    symbols[nsymbols].branch = branch;
+    nsymbols++;
+}
+
+static void
+put_string(FILE *fp, const char *s)
+/* write an RCS @-string */
+{
+    fputc('@', fp);
+    for (; *s; s++) {
+	if (*s == '@')
+	    fputc('@', fp);
+	fputc(*s, fp);
+    }
+    fputc('@', fp);
+}
+
+static void
+put_line(FILE *fp, unsigned file, unsigned id)
+/* write the content of one line */
+{
+    static const char *filler[] = {
+	"return value;", "count++;", "if (p == NULL) break;",
+	"buf[len] = '\\0';", "free(tmp);", "continue;",
+	"state = next;", "/* nothing to see here */",
+    };
+
+    fprintf(fp, "/* %u.%u */\t%s\n", file, id, filler[id % 8]);
+}
+
+static void
+put_text(FILE *fp, unsigned file, const delta *d)
+/* write a delta's full text */
+{
+    unsigned i;
+
+    fputc('@', fp);
+    for (i = 0; i < d->nlines; i++)
+	put_line(fp, file, d->lines[i]);
+    fputc('@', fp);
+}
+
+static void
+put_diff(FILE *fp, unsigned file, const delta *from, const delta *to)
+/* write the RCS edit script turning one delta's text into another's */
+{
+    unsigned pre = 0, suf = 0, ndel, nadd, i;
+
+    while (pre < from->nlines && pre < to->nlines
+	   && from->lines[pre] == to->lines[pre])
+	pre++;
+    while (suf < from->nlines - pre && suf < to->nlines - pre
+	   && from->lines[from->nlines - 1 - suf] == to->lines[to->nlines - 1 - suf])
+	suf++;
+    ndel = from->nlines - pre - suf;
+    nadd = to->nlines - pre - suf;
+
+    fputc('@', fp);
+    if (ndel)
+	fprintf(fp, "d%u %u\n", pre + 1, ndel);
+    if (nadd) {
+	fprintf(fp, "a%u %u\n", pre + ndel, nadd);
+	for (i = 0; i < nadd; i++)
+	    put_line(fp, file, to->lines[pre + i]);
+    }
+    fputc('@', fp);
+}
+
+static const char *
+rcsdate(time_t t)
+/* format a date the way RCS stores it */
+{
+    static char buf[32];
+    struct tm *tm = gmtime(&t);
+
+    strftime(buf, sizeof(buf), "%Y.%m.%d.%H.%M.%S", tm);
+    return buf;
+}
+
+static void
+put_delta(FILE *fp, const delta *d)
+/* write one delta's administrative entry */
+{
+    char buf[MAXDEPTH * 8];
+    int i;
+
+    fprintf(fp, "\n%s\n", revstr(&d->num, buf));
+    fprintf(fp, "date\t%s;\tauthor %s;\tstate %s;\nbranches",
+	    rcsdate(d->date), authors[d->author], d->dead ? "dead" : "Exp");
+    for (i = 0; i < d->nbranches; i++)
+	fprintf(fp, "\n\t%s", revstr(&deltas[d->branches[i]].num, buf));
+    fprintf(fp, ";\nnext\t%s;\n",
+	    d->next >= 0 ? revstr(&deltas[d->next].num, buf) : "");
+    if (d->has_commitid) {
+	uint64_t id;
+	rng_seed(&id, seed, d->event + 1);
+	fprintf(fp, "commitid\t%016llx;\n", (unsigned long long)id);
+    }
+}
+
+static void
+dir_path(char *buf, unsigned dir)
+/* build a directory path; directories form a tree of fanout 8 */
+{
+    char tail[32];
+
+    if (dir == 0) {
+	buf[0] = '\0';
+	return;
+    }
+    dir_path(buf, (dir - 1) / 8);
+    snprintf(tail, sizeof(tail), "dir%u/", dir);
+    strcat(buf, tail);
+}
+
+static void
+make_dirs(char *path)
+/* mkdir -p the directory part of path */
+{
+    char *p;
+
+    for (p = path + 1; *p; p++)
+	if (*p == '/') {
+	    *p = '\0';
+	    if (mkdir(path, 0777) == -1 && errno != EEXIST)
+		fatal("cannot create %s: %s", path, strerror(errno));
+	    *p = '/';
+	}
+}
+
+static void
+write_file(const char *outdir, unsigned f, char **logs)
+/* generate and write the master for one file */
+{
+    uint64_t rng;
+    file_branch *vendor;
+    unsigned *fe = file_events + file_first[f];
+    unsigned nfe = file_first[f + 1] - file_first[f];
+    unsigned i = 0, g = 0, e;
+    int trunk_head = -1, newer, n, j;
+    bool vendor_default = false;
+    revnum r;
+    char path[PATH_MAX], dir[PATH_MAX], name[64], buf[MAXDEPTH * 8];
+    FILE *fp;
+
+    rng_seed(&rng, seed, (uint64_t)f << 32 | 0xFFFFFFFFu);
+    ndeltas = 0;
+    nsymbols = 0;
+    next_line = 0;
+    memset(branches, 0, sizeof(file_branch) * (nbranches + 2));
+    vendor = &branches[nbranches + 1];
+
+    /* walk this file's events merged with the global branch and tag events */
+    while (i < nfe || g < nglobal) {
+	const event *ev;
+	file_branch *fb;
+
+	if (g >= nglobal || (i < nfe && fe[i] < global_events[g]))
+	    e = fe[i++];
+	else
+	    e = global_events[g++];
+	ev = &events[e];
+	if (e < birth[f])
+	    continue;
+
+	switch (ev->kind) {
+	case EV_IMPORT:
+	    if (trunk_head < 0) {
+		r.n = 0;
+		r = revchild(&r, 1, 1);
+		trunk_head = new_delta(-1, &r, ev, e, "Initial revision\n");
+		vendor->exists = true;
+		vendor->point = trunk_head;
+		vendor->number = revchild(&r, 1, 0);
+		vendor->head = -1;
+		vendor_default = true;
+		add_symbol("VENDOR", &vendor->number, true);
+	    } else if (!vendor_default)
+		break;
+	    r = revchild(&vendor->number,
+			 vendor->head < 0 ? 1 : deltas[vendor->head].num.d[vendor->number.n] + 1, 0);
+	    n = new_delta(vendor->head < 0 ? vendor->point : vendor->head, &r, ev, e, logs[e]);
+	    if (vendor->head < 0)
+		add_sprout(vendor->point, n);
+	    else {
+		deltas[vendor->head].next = n;
+		edit_delta(n, &rng);
+		skew_delta(n, &rng);
+	    }
+	    vendor->head = n;
+	    snprintf(name, sizeof(name), "RELEASE_%u", ev->index + 1);
+	    add_symbol(name, &r, false);
+	    break;
+
+	case EV_BRANCH:
+	    fb = &branches[ev->index];
+	    n = vendor_default && vendor->head >= 0 ? vendor->head : trunk_head;
+	    if (n < 0 || deltas[n].dead)
+		break;
+	    fb->exists = true;
+	    fb->point = n;
+	    fb->head = -1;
+	    deltas[n].nsprouts++;
+	    fb->number = revchild(&deltas[n].num, 2 * deltas[n].nsprouts, 0);
+	    r = revchild(&deltas[n].num, 0, 2 * deltas[n].nsprouts);
+	    snprintf(name, sizeof(name), "BRANCH_%u", ev->index);
+	    add_symbol(name, &r, true);
+	    break;
+
+	case EV_TAG:
+	    if (ev->branch) {
+		fb = &branches[ev->branch];
+		if (!fb->exists)
+		    break;
+		n = fb->head >= 0 ? fb->head : fb->point;
+	    } else
+		n = vendor_default && vendor->head >= 0 ? vendor->head : trunk_head;
+	    if (n < 0 || deltas[n].dead)
+		break;
+	    snprintf(name, sizeof(name), "TAG_%u", ev->index);
+	    add_symbol(name, &deltas[n].num, false);
+	    break;
+
+	case EV_COMMIT:
+	    if (ev->branch) {
+		fb = &branches[ev->branch];
+		if (!fb->exists)
+		    break;
+		r = revchild(&fb->number, fb->head < 0 ? 1 : deltas[fb->head].num.d[fb->number.n] + 1, 0);
+		n = new_delta(fb->head < 0 ? fb->point : fb->head, &r, ev, e, logs[e]);
+		if (fb->head < 0)
+		    add_sprout(fb->point, n);
+		else
+		    deltas[fb->head].next = n;
+		fb->head = n;
+	    } else if (trunk_head < 0) {
+		r.n = 0;
+		r = revchild(&r, 1, 1);
+		trunk_head = n = new_delta(-1, &r, ev, e, logs[e]);
+		skew_delta(n, &rng);
+		break;
+	    } else {
+		r = deltas[trunk_head].num;
+		r.d[1]++;
+		/* a trunk commit ends the vendor branch's reign as default */
+		n = new_delta(vendor_default && vendor->head >= 0 ? vendor->head : trunk_head,
+			      &r, ev, e, logs[e]);
+		deltas[n].next = trunk_head;
+		trunk_head = n;
+		vendor_default = false;
+	    }
+	    /* a revision after a deletion always brings the file back */
+	    if (!deltas[deltas[n].parent].dead)
+		deltas[n].dead = rng_pct(&rng, dead_pct);
+	    if (!deltas[n].dead)
+		edit_delta(n, &rng);
+	    skew_delta(n, &rng);
+	    break;
+	}
+    }
+    if (trunk_head < 0)
+	return;
+
+    dir_path(dir, ndirs ? f % ndirs : 0);
+    snprintf(path, sizeof(path), "%s/%s%sfile%u.c,v", outdir, dir,
+	     deltas[trunk_head].dead && !vendor_default ? "Attic/" : "", f);
+    make_dirs(path);
+    if ((fp = fopen(path, "w")) == NULL)
+	fatal("cannot write %s: %s", path, strerror(errno));
+
+    fprintf(fp, "head\t%s;\n", revstr(&deltas[trunk_head].num, buf));
+    if (vendor_default)
+	fprintf(fp, "branch\t%s;\n", revstr(&vendor->number, buf));
+    fprintf(fp, "access;\nsymbols");
+    for (j = nsymbols - 1; j >= 0; j--)
+	fprintf(fp, "\n\t%s:%s", symbols[j].name, revstr(&symbols[j].num, buf));
+    fprintf(fp, ";\nlocks; strict;\ncomment\t@ * @;\n\n");
+
+    /* trunk from the head down, then everything else in creation order */
+    for (n = trunk_head; n >= 0; n = deltas[n].next)
+	put_delta(fp, &deltas[n]);
+    for (n = 0; n < ndeltas; n++)
+	if (deltas[n].num.n > 2)
+	    put_delta(fp, &deltas[n]);
+
+    fprintf(fp, "\n\ndesc\n@@\n");
+    for (newer = -1, n = trunk_head; n >= 0; newer = n, n = deltas[n].next) {
+	fprintf(fp, "\n\n%s\nlog\n", revstr(&deltas[n].num, buf));
+	put_string(fp, deltas[n].log);
+	fprintf(fp, "\ntext\n");
+	if (newer < 0)
+	    put_text(fp, f, &deltas[n]);
+	else
+	    put_diff(fp, f, &deltas[newer], &deltas[n]);
+	fputc('\n', fp);
+    }
+    for (n = 0; n < ndeltas; n++)
+	if (deltas[n].num.n > 2) {
+	    fprintf(fp, "\n\n%s\nlog\n", revstr(&deltas[n].num, buf));
+	    put_string(fp, deltas[n].log);
+	    fprintf(fp, "\ntext\n");
+	    put_diff(fp, f, &deltas[deltas[n].parent], &deltas[n]);
+	    fputc('\n', fp);
+	}
+
+    if (fclose(fp) != 0)
+	fatal("error writing %s: %s", path, strerror(errno));
+
+    for (n = 0; n < ndeltas; n++) {
+	free(deltas[n].lines);
+	free(deltas[n].branches);
+    }
+    for (j = 0; j < nsymbols; j++)
+	free(symbols[j].name);
+}
+
+static void
+usage(void)
+/* explain the switches */
+{
+    fprintf(stderr,
+	    "usage: %s [options] outdir\n"
+	    " -f N  files (%u)\n"
+	    " -c N  commits (%u)\n"
+	    " -w N  average files touched per commit (%u)\n"
+	    " -b N  branches (%u)\n"
+	    " -t N  tags (%u)\n"
+	    " -v N  vendor imports (%u)\n"
+	    " -l N  initial lines per file (%u)\n"
+	    " -i N  percentage of commits with a commitid (%u)\n"
+	    " -k N  percentage of file revisions with clock skew (%u)\n"
+	    " -K N  maximum clock skew in seconds (%u)\n"
+	    " -x N  percentage of file revisions that are deletions (%u)\n"
+	    " -d N  directories (files/16)\n"
+	    " -s N  random seed (%lu)\n",
+	    progname, nfiles, ncommits, width, nbranches, ntags, nimports,
+	    nlines, commitid_pct, skew_pct, skew_max, dead_pct, seed);
+    exit(2);
+}
+
+static unsigned
+number(const char *arg)
+/* parse a non-negative switch argument */
+{
+    char *end;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(arg, &end, 10);
+    if (errno || *end || end == arg || v > UINT_MAX / 4)
+	fatal("bad numeric argument '%s'", arg);
+    return (unsigned)v;
+}
+
+int
+main(int argc, char **argv)
+{
+    char **logs;
+    unsigned e, f;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:c:w:b:t:v:l:i:k:K:x:d:s:")) != -1)
+	switch (c) {
+	case 'f': nfiles = number(optarg); break;
+	case 'c': ncommits = number(optarg); break;
+	case 'w': width = number(optarg); break;
+	case 'b': nbranches = number(optarg); break;
+	case 't': ntags = number(optarg); break;
+	case 'v': nimports = number(optarg); break;
+	case 'l': nlines = number(optarg); break;
+	case 'i': commitid_pct = number(optarg); break;
+	case 'k': skew_pct = number(optarg); break;
+	case 'K': skew_max = number(optarg); break;
+	case 'x': dead_pct = number(optarg); break;
+	case 'd': ndirs = number(optarg); break;
+	case 's': seed = number(optarg); break;
+	default: usage();
+	}
+    if (optind != argc - 1)
+	usage();
+    if (nfiles == 0 || ncommits == 0 || width == 0)
+	fatal("need at least one file, one commit and a nonzero width");
+    if (ndirs == 0)
+	ndirs = nfiles / 16 + 1;
+
+    plan_history();
+
+    logs = xmalloc(sizeof(char *) * nevents);
+    for (e = 0; e < nevents; e++) {
+	char buf[128];
+	if (events[e].kind == EV_IMPORT)
+	    snprintf(buf, sizeof(buf), "Import of vendor release %u.\n",
+		     events[e].index + 1);
+	else
+	    snprintf(buf, sizeof(buf), "Change %u to the %s.\n",
+		     events[e].index, subsystems[e % NSUBSYSTEMS]);
+	logs[e] = strdup(buf);
+    }
+
+    branches = xmalloc(sizeof(file_branch) * (nbranches + 2));
+    for (f = 0; f < nfiles; f++)
+	write_file(argv[optind], f, logs);
+
+    return 0;
+}
+
+/* end */
@@ -0,0 +1,215 @@
+/*
+ * hashbench - compare the hash functions behind hash.h
+ *
+ * Reads keys from standard input, one per line, drops duplicates the
+ * way atom() would, and for each of the hash functions in hash.c
+ * reports how fast it hashes them and how evenly it spreads them.
+ * Two key sets are measured: the strings themselves, as atom() hashes
+ * them, and the addresses of separately allocated copies, as the
+ * HASH_VALUE() users keyed on atoms (tags, symbols, path trie, commit
+ * cliques) hash them.
+ *
+ * Spread is shown for the table shapes the program uses: modulo the
+ * atom table's prime, and masked to the power of two at or above the
+ * key count, as the growing tables do.  For each shape the mean
+ * successful-lookup chain length is given next to what a uniformly
+ * random hash would average, along with the longest chain.  Full
+ * 32-bit collisions are counted too.
+ *
+ * hash.c is included rather than linked so that every backend can be
+ * called, whichever one the build selects.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../hash.c"
+
+#define ATOM_HASH_SIZE	49157	/* HASH_SIZE in atom.c */
+
+typedef struct {
+    const char *name;
+    hash_t (*init)(void);
+    hash_t (*mix)(hash_t, const char *, size_t);
+} backend;
+
+static backend backends[] = {
+    {"fnv1a",	fnv1a_hash_init,	fnv1a_hash_mix},
+    {"word",	word_hash_init,		word_hash_mix},
+    {"crc32c",	crc32c_hash_init,	crc32c_hash_mix},
+};
+#define NBACKENDS	(sizeof(backends) / sizeof(backends[0]))
+
+typedef struct {
+    const char	*name;
+    size_t	n;
+    const char	**data;		/* key bytes */
+    size_t	*len;
+} keyset;
+
+static int
+strptr_compare(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int
+hash_compare(const void *a, const void *b)
+{
+    hash_t x = *(const hash_t *)a, y = *(const hash_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+time_hash(const backend *b, const keyset *ks)
+/* nanoseconds per key, over enough rounds to take a fifth of a second */
+{
+    volatile hash_t sink = 0;
+    double start = now(), elapsed;
+    size_t rounds = 0, i;
+
+    do {
+	for (i = 0; i < ks->n; i++)
+	    sink ^= b->mix(b->init(), ks->data[i], ks->len[i]);
+	rounds++;
+    } while ((elapsed = now() - start) < 0.2);
+    (void)sink;
+    return elapsed * 1e9 / ((double)rounds * ks->n);
+}
+
+static void
+spread(const hash_t *h, size_t n, size_t nbuckets, bool mask,
+       double *mean, double *ideal, size_t *longest)
+/* chain statistics for n hashes in a table of nbuckets */
+{
+    size_t *count = calloc(nbuckets, sizeof(size_t));
+    size_t i;
+    double probes = 0;
+
+    *longest = 0;
+    for (i = 0; i < n; i++) {
+	size_t b = mask ? (h[i] & (nbuckets - 1)) : (h[i] % nbuckets);
+	if (++count[b] > *longest)
+	    *longest = count[b];
+    }
+    for (i = 0; i < nbuckets; i++)
+	probes += count[i] * (count[i] + 1) / 2.0;
+    *mean = probes / n;
+    *ideal = 1 + (n - 1) / (2.0 * nbuckets);
+    free(count);
+}
+
+static void
+report(const backend *b, const keyset *ks)
+{
+    hash_t *h = malloc(ks->n * sizeof(hash_t));
+    size_t pow2 = 1, i, full = 0, longest_prime, longest_pow2;
+    double ns, mean_prime, ideal_prime, mean_pow2, ideal_pow2;
+
+    for (i = 0; i < ks->n; i++)
+	h[i] = b->mix(b->init(), ks->data[i], ks->len[i]);
+    while (pow2 < ks->n)
+	pow2 *= 2;
+    spread(h, ks->n, ATOM_HASH_SIZE, false, &mean_prime, &ideal_prime, &longest_prime);
+    spread(h, ks->n, pow2, true, &mean_pow2, &ideal_pow2, &longest_pow2);
+    qsort(h, ks->n, sizeof(hash_t), hash_compare);
+    for (i = 1; i < ks->n; i++)
+	if (h[i] == h[i - 1])
+	    full++;
+    ns = time_hash(b, ks);
+    printf("%-8s %-8s %8.2f  %6.3f/%6.3f %4zu  %6.3f/%6.3f %4zu  %6zu\n",
+	   ks->name, b->name, ns,
+	   mean_prime, ideal_prime, longest_prime,
+	   mean_pow2, ideal_pow2, longest_pow2, full);
+    free(h);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char	line[BUFSIZ];
+    char	**keys = NULL;
+    size_t	nkeys = 0, maxkeys = 0, total, i, j;
+    keyset	strings, pointers;
+    const char	**addr;
+
+    (void)argv;
+    if (argc > 1) {
+	fprintf(stderr, "usage: hashbench <keys\n");
+	return 2;
+    }
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+	line[strcspn(line, "\n")] = '\0';
+	if (nkeys == maxkeys) {
+	    maxkeys = maxkeys ? maxkeys * 2 : 1024;
+	    keys = realloc(keys, maxkeys * sizeof(char *));
+	}
+	keys[nkeys++] = strdup(line);
+    }
+    if (nkeys == 0) {
+	fprintf(stderr, "hashbench: no keys\n");
+	return 1;
+    }
+    qsort(keys, nkeys, sizeof(char *), strptr_compare);
+    for (i = j = 1; i < nkeys; i++)
+	if (strcmp(keys[i], keys[j - 1]) != 0)
+	    keys[j++] = keys[i];
+    nkeys = j;
+
+    strings.name = "strings";
+    strings.n = nkeys;
+    strings.data = (const char **)keys;
+    strings.len = malloc(nkeys * sizeof(size_t));
+    for (i = 0; i < nkeys; i++)
+	strings.len[i] = strlen(keys[i]);
+
+    /* copy in shuffled order so the addresses aren't in key order */
+    addr = malloc(nkeys * sizeof(char *));
+    memcpy(addr, keys, nkeys * sizeof(char *));
+    srand(1);
+    for (i = nkeys - 1; i > 0; i--) {
+	const char *t;
+	j = rand() % (i + 1);
+	t = addr[i]; addr[i] = addr[j]; addr[j] = t;
+    }
+    for (i = 0; i < nkeys; i++)
+	addr[i] = strdup(addr[i]);
+    pointers.name = "pointers";
+    pointers.n = nkeys;
+    pointers.data = malloc(nkeys * sizeof(char *));
+    pointers.len = malloc(nkeys * sizeof(size_t));
+    for (i = 0; i < nkeys; i++) {
+	pointers.data[i] = (const char *)&addr[i];
+	pointers.len[i] = sizeof(char *);
+    }
+
+    total = 0;
+    for (i = 0; i < nkeys; i++)
+	total += strings.len[i];
+    printf("%zu distinct keys, mean length %.1f", nkeys, (double)total / nkeys);
+#ifdef HAVE_CRC32C_SSE42
+    printf("; crc32c %s\n", crc32c_mix == crc32c_sse42 ? "uses SSE4.2" : "uses the table");
+#else
+    printf("; crc32c uses the table\n");
+#endif /* HAVE_CRC32C_SSE42 */
+    printf("%-8s %-8s %8s  %-18s  %-18s  %6s\n", "keys", "hash", "ns/key",
+	   "chain%49157 max", "chain&pow2 max", "32-bit");
+    for (i = 0; i < NBACKENDS; i++)
+	report(&backends[i], &strings);
+    for (i = 0; i < NBACKENDS; i++)
+	report(&backends[i], &pointers);
+    return 0;
+}
+
+/* end */
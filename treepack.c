@@ -15,7 +15,7 @@ struct _rev_pack {
     serial_t   ndirs;
     serial_t   nfiles;
     rev_pack   **dirs;
-    cvs_commit **files;
+    commit_handle *files;
 };
 
 typedef struct _rev_pack_hash {
@@ -36,7 +36,7 @@ typedef struct _pack_frame {
 /* variables used by streaming pack interface */
 static serial_t         sfiles = 0;
 static serial_t         nfiles = 0;
-static const cvs_commit **files = NULL;
+static commit_handle	*files = NULL;
 static pack_frame       *frame;
 static pack_frame       frames[MAX_DIR_DEPTH];
 
@@ -51,7 +51,7 @@ rev_pack_dir(void)
 	if (h->dir.hash == frame->hash &&
 	    h->dir.nfiles == nfiles && h->dir.ndirs == frame->ndirs &&
 	    !memcmp(frame->dirs, h->dir.dirs, frame->ndirs * sizeof(rev_pack *)) &&
-	    !memcmp(files, h->dir.files, nfiles * sizeof(cvs_commit *)))
+	    !memcmp(files, h->dir.files, nfiles * sizeof(commit_handle)))
 	{
 	    return &h->dir;
 	}
@@ -64,8 +64,8 @@ rev_pack_dir(void)
     h->dir.dirs = xmalloc(frame->ndirs * sizeof(rev_pack *), __func__);
     memcpy(h->dir.dirs, frame->dirs, frame->ndirs * sizeof(rev_pack *));
     h->dir.nfiles = nfiles;
-    h->dir.files = xmalloc(nfiles * sizeof(cvs_commit *), __func__);
-    memcpy(h->dir.files, files, nfiles * sizeof(cvs_commit *));
+    h->dir.files = xmalloc(nfiles * sizeof(commit_handle), __func__);
+    memcpy(h->dir.files, files, nfiles * sizeof(commit_handle));
     return &h->dir;
 }
 
@@ -77,8 +77,8 @@ typedef struct _dir_pos {
 } dir_pos;
 
 struct _revdir_iter {
-    cvs_commit     **file;
-    cvs_commit     **filemax;
+    commit_handle  *file;
+    commit_handle  *filemax;
     size_t         dirpos; // current dir is dirstack[dirpos]
     dir_pos        dirstack[MAX_DIR_DEPTH];
 };
@@ -94,7 +94,7 @@ cvs_commit *
 revdir_iter_next(revdir_iter *it) {
     while (1) {
 	if (it->file != it->filemax)
-	    return *it->file++;
+	    return cvs_commit_at(*it->file++);
 	// end of stack
 	if (!it->dirpos)
 	    return NULL;
@@ -154,7 +154,7 @@ revdir_iter_next_dir(revdir_iter *it)
 	    it->filemax = dir->files + dir->nfiles;
 	}
 	if (it->file != it->filemax)
-	    return *it->file++;
+	    return cvs_commit_at(*it->file++);
     }
 }
 
@@ -199,10 +199,10 @@ void
 revdir_pack_alloc(const size_t max_size)
 {
     if (!files) {
-	files = xmalloc(max_size * sizeof(cvs_commit *), __func__);
+	files = xmalloc(max_size * sizeof(commit_handle), __func__);
 	sfiles = max_size;
     } else if (sfiles < max_size) {
-	files = xrealloc(files, max_size * sizeof(cvs_commit *), __func__);
+	files = xrealloc(files, max_size * sizeof(commit_handle), __func__);
 	sfiles = max_size;
     }
 }
@@ -233,7 +233,7 @@ push_rev_pack(const rev_pack * const r)
 }
 
 void
-revdir_pack_add(const cvs_commit *file, const master_dir *dir)
+revdir_pack_add(const commit_handle file, const master_dir *dir)
 {
     while (1) {
 	if (frame->dir == dir) {
@@ -245,7 +245,7 @@ revdir_pack_add(const cvs_commit *file, const master_dir *dir)
 	     * with the amount of data we're typically mixing into the hash
              * and very lightweight
 	     */
- 	    frame->hash = (frame->hash ^ (uintptr_t)file) * 16777619U;
+ 	    frame->hash = (frame->hash ^ file) * 16777619U;
 	    return;
 	}
 	if (dir_is_ancestor(dir, frame->dir)) {
@@ -337,7 +337,7 @@ revdir_pack_files(const cvs_commit **files, const size_t nfiles, revdir *revdir)
     revdir_pack_alloc(nfiles);
     revdir_pack_init();
     for (i = 0; i < nfiles; i++)
-	revdir_pack_add(files[i], files[i]->dir);
+	revdir_pack_add(cvs_commit_handle(files[i]), files[i]->dir);
 	
     revdir_pack_end(revdir);
     revdir_pack_free();
@@ -360,6 +360,101 @@ revdir_free(void)
     }
 }
 
+void
+revdir_save_packs(serial_t (*file_index)(const cvs_commit *))
+{
+    size_t i;
+    serial_t n = 0, j, k, ref;
+    rev_pack_hash *h;
+
+    for (i = 0; i < REV_DIR_HASH; i++)
+	for (h = buckets[i]; h; h = h->next)
+	    n++;
+    checkpoint_packs = xmalloc(n * sizeof(void *), __func__);
+    checkpoint_npacks = 0;
+    for (i = 0; i < REV_DIR_HASH; i++)
+	for (h = buckets[i]; h; h = h->next)
+	    checkpoint_packs[checkpoint_npacks++] = &h->dir;
+    qsort(checkpoint_packs, n, sizeof(void *), compare_address);
+
+    checkpoint_put(&n, sizeof(n));
+    for (j = 0; j < n; j++) {
+	const rev_pack *r = checkpoint_packs[j];
+	checkpoint_put(&r->hash, sizeof(r->hash));
+	checkpoint_put(&r->ndirs, sizeof(r->ndirs));
+	checkpoint_put(&r->nfiles, sizeof(r->nfiles));
+	for (k = 0; k < r->ndirs; k++) {
+	    ref = checkpoint_pack_index(r->dirs[k]);
+	    checkpoint_put(&ref, sizeof(ref));
+	}
+	for (k = 0; k < r->nfiles; k++) {
+	    ref = file_index(cvs_commit_at(r->files[k]));
+	    checkpoint_put(&ref, sizeof(ref));
+	}
+    }
+}
+
+void
+revdir_save(const revdir *revdir)
+{
+    serial_t ref = 0;
+
+    if (revdir->revpack)
+	ref = checkpoint_pack_index(revdir->revpack) + 1;
+    checkpoint_put(&ref, sizeof(ref));
+}
+
+void
+revdir_load_packs(cvs_commit *(*file_at)(serial_t))
+{
+    serial_t n, j, k, ref;
+    rev_pack_hash *h;
+
+    checkpoint_get(&n, sizeof(n));
+    checkpoint_packs = xmalloc(n * sizeof(void *), __func__);
+    checkpoint_npacks = n;
+    for (j = 0; j < n; j++) {
+	h = xmalloc(sizeof(rev_pack_hash), __func__);
+	checkpoint_get(&h->dir.hash, sizeof(h->dir.hash));
+	checkpoint_get(&h->dir.ndirs, sizeof(h->dir.ndirs));
+	checkpoint_get(&h->dir.nfiles, sizeof(h->dir.nfiles));
+	h->dir.dirs = xmalloc(h->dir.ndirs * sizeof(rev_pack *), __func__);
+	for (k = 0; k < h->dir.ndirs; k++) {
+	    /* subdirectories may come later in the file, resolved below */
+	    checkpoint_get(&ref, sizeof(ref));
+	    h->dir.dirs[k] = (rev_pack *)(uintptr_t)ref;
+	}
+	h->dir.files = xmalloc(h->dir.nfiles * sizeof(commit_handle), __func__);
+	for (k = 0; k < h->dir.nfiles; k++) {
+	    checkpoint_get(&ref, sizeof(ref));
+	    h->dir.files[k] = cvs_commit_handle(file_at(ref));
+	}
+	h->next = buckets[h->dir.hash % REV_DIR_HASH];
+	buckets[h->dir.hash % REV_DIR_HASH] = h;
+	checkpoint_packs[j] = &h->dir;
+    }
+    for (j = 0; j < n; j++) {
+	rev_pack *r = checkpoint_packs[j];
+	for (k = 0; k < r->ndirs; k++) {
+	    ref = (serial_t)(uintptr_t)r->dirs[k];
+	    if (ref >= n)
+		fatal_error("checkpoint pack reference out of range");
+	    r->dirs[k] = checkpoint_packs[ref];
+	}
+    }
+}
+
+void
+revdir_load(revdir *revdir)
+{
+    serial_t ref;
+
+    checkpoint_get(&ref, sizeof(ref));
+    if (ref > checkpoint_npacks)
+	fatal_error("checkpoint pack reference out of range");
+    revdir->revpack = ref ? checkpoint_packs[ref - 1] : NULL;
+}
+
 void
 revdir_free_bufs(void)
 {
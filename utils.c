@@ -1,4 +1,8 @@
 #include <stdlib.h>
+#include <stdatomic.h>
+#ifdef THREADS
+#include <pthread.h>
+#endif /* THREADS */
 #include "cvs.h"
 
 #if defined(__APPLE__)
@@ -29,6 +33,9 @@ void* xmemalign(size_t align, size_t size, char const *legend)
     if (err)
 	fatal_error("posix_memalign(%zd, %zd) failed in %s: %s",
 			   align, size, legend, strerror(err));
+#ifdef MEMSTATS
+    memstats_alloc(ret, size, legend);
+#endif /* MEMSTATS */
     return ret;
 }
 #endif
@@ -43,6 +50,9 @@ void* xmalloc(size_t size, char const *legend)
     if (!ret)
 	fatal_system_error("Out of memory, malloc(%zd) failed in %s",
 			   size, legend);
+#ifdef MEMSTATS
+    memstats_alloc(ret, size, legend);
+#endif /* MEMSTATS */
     return ret;
 }
 
@@ -52,12 +62,21 @@ void* xcalloc(size_t nmemb, size_t size, char const *legend)
     if (!ret)
 	fatal_system_error("Out of memory, calloc(%zd, %zd) failed in %s",
 			   nmemb, size, legend);
+#ifdef MEMSTATS
+    memstats_alloc(ret, nmemb * size, legend);
+#endif /* MEMSTATS */
     return ret;
 }
 
 void* xrealloc(void *ptr, size_t size, char const *legend)
 {
-    void *ret = realloc(ptr, size);
+    void *ret;
+
+#ifdef MEMSTATS
+    /* before the old block can be freed and handed to another thread */
+    memstats_free(ptr);
+#endif /* MEMSTATS */
+    ret = realloc(ptr, size);
 #ifndef __COVERITY__
     if (!ret && !size)
 	ret = realloc(ptr, 1);
@@ -65,6 +84,9 @@ void* xrealloc(void *ptr, size_t size, char const *legend)
     if (!ret)
 	fatal_system_error("Out of memory, realloc(%zd) failed in %s",
 			   size, legend);
+#ifdef MEMSTATS
+    memstats_alloc(ret, size, legend);
+#endif /* MEMSTATS */
     return ret;
 }
 
@@ -84,24 +106,110 @@ cvstime2rfc3339(const cvstime_t date)
  * Print progress messages.
  *
  * Call progress_begin() at the start of some activity that may take a
- * long time.  Call progress_step() zero or more times during that
- * activity.  Call progress_end() at the end of the activity.
+ * long time.  Call progress_step() or progress_jump() zero or more
+ * times during that activity, from any thread; they only update a
+ * counter.  Call progress_end() at the end of the activity, from the
+ * thread that began it.
  *
- * Global 'progress' flag enables or disables all this.
+ * The meter is redrawn at most every PROGRESS_INTERVAL milliseconds:
+ * by a ticker thread when there are threads, otherwise by the first
+ * step to notice that the interval has passed.  Each redraw shows the
+ * rate since the activity began and, if the total is known, an
+ * estimate of the time left.
  *
- * Note: These functions are not thread-safe!
+ * Global 'progress' flag enables or disables all this.
  */
 
+#define PROGRESS_INTERVAL	100	/* milliseconds between redraws */
+
 static char *progress_msg = "";
-static int progress_counter = 0;
+static atomic_int progress_counter;
 static va_list _unused_va_list;
 static struct timespec start;  
 static int progress_max = NO_MAX;
 static bool progress_in_progress;
+#ifdef THREADS
+static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t ticker;
+static bool ticking;
+#define progress_lock()		pthread_mutex_lock(&progress_mutex)
+#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
+#else
+static struct timespec next_draw;
+#define progress_lock()
+#define progress_unlock()
+#endif /* THREADS */
 
 static void _progress_print(bool /*newline*/, const char * /*format*/, va_list)
 	_printflike(2, 0);
 
+static void
+interval_from(struct timespec *ts, const struct timespec *from)
+/* set ts to one redraw interval after from */
+{
+    ts->tv_sec = from->tv_sec;
+    ts->tv_nsec = from->tv_nsec + PROGRESS_INTERVAL * 1000000L;
+    if (ts->tv_nsec >= NANOSCALE) {
+	ts->tv_sec++;
+	ts->tv_nsec -= NANOSCALE;
+    }
+}
+
+#ifdef THREADS
+static void *
+progress_ticker(void *arg)
+/* redraw the meter until progress_end() stops us */
+{
+    struct timespec now, deadline;
+
+    (void)arg;
+    progress_lock();
+    while (ticking) {
+	clock_gettime(CLOCK_REALTIME, &now);
+	interval_from(&deadline, &now);
+	pthread_cond_timedwait(&progress_cond, &progress_mutex, &deadline);
+	if (ticking) {
+	    progress_in_progress = true;
+	    _progress_print(false, "", _unused_va_list);
+	}
+    }
+    progress_unlock();
+    return NULL;
+}
+
+static void
+progress_stop(void)
+/* stop the ticker, if it is running */
+{
+    bool was_ticking;
+
+    progress_lock();
+    was_ticking = ticking;
+    ticking = false;
+    pthread_cond_signal(&progress_cond);
+    progress_unlock();
+    if (was_ticking)
+	pthread_join(ticker, NULL);
+}
+#endif /* THREADS */
+
+static void
+progress_tick(void)
+/* redraw if the interval has passed and nothing else will */
+{
+#ifndef THREADS
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (nanosec(&now) < nanosec(&next_draw))
+	return;
+    interval_from(&next_draw, &now);
+    progress_in_progress = true;
+    _progress_print(false, "", _unused_va_list);
+#endif /* THREADS */
+}
+
 void
 progress_begin(const char *msg, const int max)
 {
@@ -111,16 +219,28 @@ progress_begin(const char *msg, const int max)
 
     if (!progress)
 	return;
+#ifdef THREADS
+    progress_stop();
+#endif /* THREADS */
+    progress_lock();
     progress_max = max;
-    progress_counter = 0;
+    atomic_store_explicit(&progress_counter, 0, memory_order_relaxed);
     progress_in_progress = true;
 
     (void)strftime(timestr, sizeof(timestr), "%Y-%m-%dT%H:%M:%SZ: ", tm);
     strncat(timestr, msg, sizeof(timestr)-1);
     progress_msg = timestr;
 
-    _progress_print(false, "", _unused_va_list);
     clock_gettime(CLOCK_REALTIME, &start);
+    _progress_print(false, "", _unused_va_list);
+#ifdef THREADS
+    ticking = true;
+    if (pthread_create(&ticker, NULL, progress_ticker, NULL) != 0)
+	ticking = false;	/* no meter animation, but the end line still prints */
+#else
+    interval_from(&next_draw, &start);
+#endif /* THREADS */
+    progress_unlock();
 }
 
 void
@@ -128,9 +248,8 @@ progress_step(void)
 {
     if (!progress)
 	return;
-    progress_in_progress = true;
-    progress_counter++;
-    _progress_print(false, "", _unused_va_list);
+    atomic_fetch_add_explicit(&progress_counter, 1, memory_order_relaxed);
+    progress_tick();
 }
 
 void
@@ -138,9 +257,8 @@ progress_jump(const int count)
 {
     if (!progress)
 	return;
-    progress_in_progress = true;
-    progress_counter = count;
-    _progress_print(false, "", _unused_va_list);
+    atomic_store_explicit(&progress_counter, count, memory_order_relaxed);
+    progress_tick();
 }
 
 void
@@ -150,38 +268,74 @@ progress_end(const char *format, ...)
 
     if (!progress)
 	return;
+#ifdef THREADS
+    progress_stop();
+#endif /* THREADS */
+    progress_lock();
     progress_in_progress = false;
-    progress_max = progress_counter; /* message will say "100%" or "done" */
+    /* message will say "100%" or "done" */
+    progress_max = atomic_load_explicit(&progress_counter, memory_order_relaxed);
     va_start(args, format);
     _progress_print(true, format, args);
     progress_max = NO_MAX;
     va_end(args);
+    progress_unlock();
+}
+
+static void
+format_eta(char *buf, size_t size, double secs)
+/* h:mm:ss, or m:ss under an hour */
+{
+    long s = (long)(secs + 0.5);
+
+    if (s >= 3600)
+	snprintf(buf, size, "%ld:%02ld:%02ld", s / 3600, s / 60 % 60, s % 60);
+    else
+	snprintf(buf, size, "%ld:%02ld", s / 60, s % 60);
 }
 
 static void
 _progress_print(bool newline, const char *format, va_list args)
+/* draw the meter; the caller holds the progress lock */
 {
+    int counter = atomic_load_explicit(&progress_counter, memory_order_relaxed);
+    struct timespec now;
+    double elapsed, rate;
+
     if (!progress)
 	return;
 
+    clock_gettime(CLOCK_REALTIME, &now);
+    elapsed = seconds_diff(&now, &start);
+    rate = elapsed > 0 ? counter / elapsed : 0;
+
     /*
      * If a non-empty format was given, use the format and args.
      * Otherwise, try to print as much information as possible,
-     * such as: <message>: <count> of <max> (<percent>)
-     * or:      <message>: <count>
+     * such as: <message>: <count> of <max> (<percent>) <rate>, ETA <time>
+     * or:      <message>: <count> <rate>
      * or:      <message>: done
      * or just: <message>
+     * The rate and ETA only appear while the activity is running.
      */
     if (format && *format) {
 	fprintf(STATUS, "\r%s", progress_msg);
 	vfprintf(STATUS, format, args);
     } else if (progress_max > 0) {
 	fprintf(STATUS, "\r%s%d of %d(%d%%)   ", progress_msg,
-		progress_counter, progress_max,
-		(progress_counter * 100 / progress_max));
-    } else if (progress_counter > 0) {
-	fprintf(STATUS, "\r%s%d", progress_msg, progress_counter);
-    } else if (progress_counter == progress_max) {
+		counter, progress_max,
+		(int)((long long)counter * 100 / progress_max));
+	if (!newline && rate > 0 && counter < progress_max) {
+	    char eta[32];
+
+	    format_eta(eta, sizeof(eta), (progress_max - counter) / rate);
+	    fprintf(STATUS, "%.0f/sec, ETA %s   ", rate, eta);
+	}
+    } else if (counter > 0) {
+	fprintf(STATUS, "\r%s%d", progress_msg, counter);
+	if (!newline)
+	    fprintf(STATUS, "   %.0f/sec   ", rate);
+    } else if (counter == progress_max) {
 	/* they should both be zero at this point, but it still means "done" */
 	fprintf(STATUS, "\r%sdone ", progress_msg);
     } else {
@@ -189,10 +343,7 @@ _progress_print(bool newline, const char *format, va_list args)
     }
     if (newline)
     {
-	struct timespec end;
-
-	clock_gettime(CLOCK_REALTIME, &end);
-	fprintf(STATUS, " (%.3fsec)", seconds_diff(&end, &start));
+	fprintf(STATUS, " (%.3fsec)", elapsed);
 	fprintf(STATUS, "\n");
     }
     fflush(STATUS);
@@ -200,6 +351,7 @@ _progress_print(bool newline, const char *format, va_list args)
 
 static void progress_interrupt(void)
 {
+    progress_lock();
     if (progress && progress_in_progress) {
 	fputc('\n', stderr);
 	progress_in_progress = false;
@@ -209,6 +361,7 @@ static void progress_interrupt(void)
 	progress_max = NO_MAX;
     }
 #endif /* __UNUSED__ */
+    progress_unlock();
 }
 
 void fatal_system_error(char const *format,...)